@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+#
+# Holger Mueller
+#
+# This file is part of sml2mqtt.
+#
+# Generates the benchmark corpus of sml2mqtt_bench.
+#
+# The telegrams are synthetic. They follow the OBIS lists, value types and
+# scalers of the named meter models, but are not recorded from real meters.
+# Each file contains a stream of telegrams as read from the IR head.
+#
+# Usage: ./gen_corpus.py [output directory]
+
+import os
+import random
+import sys
+
+
+def crc16(data):
+    """CRC16/X-25 as used by SML"""
+    crc = 0xffff
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc ^ 0xffff
+
+
+def tl(type_, n):
+    """type length field, n is the number of value bytes or list elements"""
+    if type_ == 0x70:
+        if n < 16:
+            return bytes([type_ | n])
+        return bytes([0x80 | type_ | (n >> 4), n & 0x0f])
+    if n + 1 < 16:
+        return bytes([type_ | (n + 1)])
+    return bytes([0x80 | type_ | ((n + 2) >> 4), (n + 2) & 0x0f])
+
+
+NONE = b'\x01'
+
+
+def octets(b):
+    return tl(0x00, len(b)) + b
+
+
+def unsigned(v, size):
+    return tl(0x60, size) + v.to_bytes(size, 'big')
+
+
+def integer(v, size):
+    return tl(0x50, size) + v.to_bytes(size, 'big', signed=True)
+
+
+def lst(*items):
+    return tl(0x70, len(items)) + b''.join(items)
+
+
+def time(secindex):
+    return lst(unsigned(1, 1), unsigned(secindex, 4))
+
+
+def message(txid, group, tag, body):
+    """message, the list of six elements ends with crc and endOfSmlMsg"""
+    msg = tl(0x70, 6) + octets(txid) + unsigned(group, 1) + unsigned(0, 1) + lst(unsigned(tag, 2), body)
+    crc = crc16(msg)
+    return msg + unsigned(((crc & 0xff) << 8) | (crc >> 8), 2) + b'\x00'
+
+
+def open_response(server, secindex):
+    return lst(NONE, NONE, octets(secindex.to_bytes(4, 'big')), octets(server), NONE, NONE)
+
+
+def close_response():
+    return lst(NONE)
+
+
+def entry(obis, value, unit=None, scaler=None, status=None, valtime=None):
+    return lst(octets(bytes(obis)),
+               unsigned(status, 4) if status is not None else NONE,
+               time(valtime) if valtime is not None else NONE,
+               unsigned(unit, 1) if unit is not None else NONE,
+               integer(scaler, 1) if scaler is not None else NONE,
+               value, NONE)
+
+
+def get_list_response(server, entries, secindex):
+    return lst(NONE, octets(server), NONE, time(secindex), lst(*entries), NONE, NONE)
+
+
+def frame(payload):
+    """transport v1 frame, escape sequences are 4 byte aligned"""
+    escape = b'\x1b\x1b\x1b\x1b'
+    pad = (4 - len(payload) % 4) % 4
+    payload += b'\x00' * pad
+    out = bytearray(escape + b'\x01\x01\x01\x01')
+    for i in range(0, len(payload), 4):
+        block = payload[i:i + 4]
+        out += block
+        if block == escape:
+            out += escape
+    out += escape + bytes([0x1a, pad])
+    crc = crc16(out)
+    return bytes(out + bytes([crc & 0xff, crc >> 8]))
+
+
+def obis(a, b, c, d, e, f=255):
+    return (a, b, c, d, e, f)
+
+
+def emh_ehz(rng, n, server, secindex, energy):
+    """EMH eHZ: manufacturer, server id, energy tariffs, power, public key"""
+    return [
+        entry(obis(129, 129, 199, 130, 3), octets(b'EMH')),
+        entry(obis(1, 0, 0, 0, 9), octets(server)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy, 8), 30, -1, 0x0182),
+        entry(obis(1, 0, 1, 8, 1), unsigned(energy, 8), 30, -1),
+        entry(obis(1, 0, 1, 8, 2), unsigned(0, 8), 30, -1),
+        entry(obis(1, 0, 16, 7, 0), integer(rng.randint(1000, 40000), 4), 27, -1),
+        entry(obis(129, 129, 199, 130, 5), octets(bytes(rng.getrandbits(8) for _ in range(48)))),
+    ]
+
+
+def iskra_mt681(rng, n, server, secindex, energy):
+    """ISKRA MT681: energy import/export, power per phase, status"""
+    return [
+        entry(obis(1, 0, 96, 50, 1, 1), octets(b'ISK')),
+        entry(obis(1, 0, 96, 1, 0), octets(server)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy, 8), 30, -1, 0x0104, secindex),
+        entry(obis(1, 0, 2, 8, 0), unsigned(energy // 3, 8), 30, -1),
+        entry(obis(1, 0, 1, 8, 1), unsigned(energy, 8), 30, -1),
+        entry(obis(1, 0, 2, 8, 1), unsigned(energy // 3, 8), 30, -1),
+        entry(obis(1, 0, 16, 7, 0), integer(rng.randint(-3000, 8000), 4), 27, 0),
+        entry(obis(1, 0, 36, 7, 0), integer(rng.randint(-1000, 3000), 4), 27, 0),
+        entry(obis(1, 0, 56, 7, 0), integer(rng.randint(-1000, 3000), 4), 27, 0),
+        entry(obis(1, 0, 76, 7, 0), integer(rng.randint(-1000, 3000), 4), 27, 0),
+        entry(obis(1, 0, 96, 5, 0), unsigned(0x001c0504, 4)),
+        entry(obis(0, 0, 96, 8, 0), unsigned(secindex, 4), 7),
+    ]
+
+
+def easymeter_q3a(rng, n, server, secindex, energy):
+    """EasyMeter Q3A: energy, power total and per phase (E group 255)"""
+    return [
+        entry(obis(129, 129, 199, 130, 3), octets(b'ESY')),
+        entry(obis(1, 0, 0, 0, 0), octets(b'1ESY1160' + server[-4:])),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy * 100, 8), 30, -8, 0x00000182),
+        entry(obis(1, 0, 1, 8, 1), unsigned(energy * 100, 8), 30, -8),
+        entry(obis(1, 0, 1, 8, 2), unsigned(0, 8), 30, -8),
+        entry(obis(1, 0, 1, 7, 255), integer(rng.randint(100, 500000), 4), 27, -2),
+        entry(obis(1, 0, 21, 7, 255), integer(rng.randint(100, 200000), 4), 27, -2),
+        entry(obis(1, 0, 41, 7, 255), integer(rng.randint(100, 200000), 4), 27, -2),
+        entry(obis(1, 0, 61, 7, 255), integer(rng.randint(100, 200000), 4), 27, -2),
+        entry(obis(1, 0, 96, 5, 5), octets(b'\x82')),
+        entry(obis(0, 0, 96, 1, 255), octets(server)),
+    ]
+
+
+def holley_dtz541(rng, n, server, secindex, energy):
+    """Holley DTZ541: energy, power, voltage, current, phase angle, frequency"""
+    entries = [
+        entry(obis(1, 0, 96, 50, 1, 1), octets(b'HLY')),
+        entry(obis(1, 0, 96, 1, 0), octets(server)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy, 5), 30, -1, 0x0a0104),
+        entry(obis(1, 0, 2, 8, 0), unsigned(energy // 4, 5), 30, -1),
+        entry(obis(1, 0, 16, 7, 0), integer(rng.randint(-3000, 8000), 3), 27, 0),
+    ]
+    for c in (32, 52, 72):
+        entries.append(entry(obis(1, 0, c, 7, 0), unsigned(rng.randint(2250, 2350), 2), 35, -1))
+    for c in (31, 51, 71):
+        entries.append(entry(obis(1, 0, c, 7, 0), unsigned(rng.randint(0, 1500), 2), 33, -2))
+    for e in (1, 2, 4, 5, 7):
+        entries.append(entry(obis(1, 0, 81, 7, e), unsigned(rng.randint(0, 359), 2), 8, 0))
+    entries.append(entry(obis(1, 0, 14, 7, 0), unsigned(rng.randint(499, 501), 2), 44, -1))
+    return entries
+
+
+def dzg_dws74(rng, n, server, secindex, energy):
+    """DZG DWS74: energy import/export and power"""
+    return [
+        entry(obis(1, 0, 96, 50, 1, 1), octets(b'DZG')),
+        entry(obis(1, 0, 96, 1, 0), octets(server)),
+        entry(obis(1, 0, 1, 8, 0), unsigned(energy, 4), 30, -1, 0x0202, secindex),
+        entry(obis(1, 0, 2, 8, 0), unsigned(energy // 2, 4), 30, -1),
+        entry(obis(1, 0, 16, 7, 0), integer(rng.randint(-3000, 8000), 4), 27, -2),
+    ]
+
+
+MODELS = {
+    'emh_ehz': emh_ehz,
+    'iskra_mt681': iskra_mt681,
+    'easymeter_q3a': easymeter_q3a,
+    'holley_dtz541': holley_dtz541,
+    'dzg_dws74': dzg_dws74,
+}
+
+TELEGRAMS = 32
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    for name, model in sorted(MODELS.items()):
+        rng = random.Random(name)
+        server = bytes([0x0a, 0x01]) + bytes(rng.getrandbits(8) for _ in range(8))
+        energy = rng.randint(10000000, 90000000)
+        secindex = rng.randint(1000000, 9000000)
+        stream = bytearray()
+        for n in range(TELEGRAMS):
+            energy += rng.randint(0, 50)
+            secindex += 1
+            txid = (secindex & 0xffffff).to_bytes(3, 'big')
+            stream += frame(
+                message(txid + b'\x00', 0, 0x0101, open_response(server, secindex)) +
+                message(txid + b'\x01', 0, 0x0701, get_list_response(server, model(rng, n, server, secindex, energy), secindex)) +
+                message(txid + b'\x02', 0, 0x0201, close_response()))
+        with open(os.path.join(directory, name + '.sml'), 'wb') as f:
+            f.write(stream)
+
+
+if __name__ == '__main__':
+    main()
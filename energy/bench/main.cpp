@@ -0,0 +1,394 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+/* C includes */
+#include <mosquitto.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+/* project internal includes */
+#include "Crc16.h"
+#include "Format.h"
+#include "MqttClient.h"
+#include "ObisMap.h"
+#include "SML.h"
+#include "SmlDecoder.h"
+#include "SmlFramer.h"
+
+/** number of heap allocations */
+static std::atomic<uint64_t> allocations(0);
+
+/* count allocations, not inlined to keep the compiler from pairing malloc and delete */
+__attribute__((noinline)) void * operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void * ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void * ptr) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void * ptr, std::size_t) noexcept
+{
+    free(ptr);
+}
+
+/** topic the benchmark publishes to */
+static const std::string benchTopic = "/devices/sml2mqtt-bench/controls";
+
+/** bytes per read, like a read from the IR head */
+static const size_t chunkSize = 256;
+
+/** telegrams of one meter model */
+struct Corpus
+{
+    /** file name */
+    std::string name;
+
+    /** raw stream as read from the IR head */
+    std::vector<unsigned char> stream;
+
+    /** frames without escape sequences */
+    std::vector<std::vector<unsigned char>> frames;
+};
+
+/** mapped value of a telegram, prepared for the later stages */
+struct Sample
+{
+    /** register index */
+    int index;
+
+    /** value, scaler and register scale applied */
+    double value;
+
+    /** formatted value */
+    std::string payload;
+};
+
+/** result of one stage */
+struct Result
+{
+    /** time per telegram */
+    double nsPerTelegram;
+
+    /** heap allocations per telegram */
+    double allocsPerTelegram;
+};
+
+/**
+ * run a stage repeatedly for at least minTime, after one warm up run
+ *
+ * @param[in] telegrams number of telegrams processed by one run
+ * @param[in] minTime minimum measurement time
+ * @param[in] run stage
+ * @return time and allocations per telegram
+ */
+template<typename F>
+static Result measure(size_t telegrams, std::chrono::milliseconds minTime, F run)
+{
+    run();
+
+    uint64_t runs = 0;
+    uint64_t allocs = allocations.load(std::memory_order_relaxed);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration elapsed;
+    do {
+        run();
+        runs++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed < minTime);
+    allocs = allocations.load(std::memory_order_relaxed) - allocs;
+
+    double count = static_cast<double>(runs * telegrams);
+    Result result = {
+        std::chrono::duration<double, std::nano>(elapsed).count() / count,
+        allocs / count
+    };
+    return result;
+}
+
+/**
+ * print a result
+ *
+ * @param[in] stage name of stage
+ * @param[in] result result
+ */
+static void print(const std::string & stage, const Result & result)
+{
+    printf("%-32s %12.1f %16.2f\n", stage.c_str(), result.nsPerTelegram, result.allocsPerTelegram);
+}
+
+/**
+ * read a corpus file and split it into frames
+ *
+ * @param[in] name file name
+ * @param[out] corpus corpus
+ * @return false if the file can't be read or contains no frames
+ */
+static bool load(const std::string & name, Corpus & corpus)
+{
+    std::ifstream file(name, std::ios::binary);
+    if (!file) {
+        std::cerr << "load: can't open " << name << std::endl;
+        return false;
+    }
+    corpus.name = name;
+    corpus.stream.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    SmlFramer framer;
+    SmlFrame frame;
+    for (size_t pos = 0; pos < corpus.stream.size(); pos += chunkSize) {
+        size_t len = std::min(chunkSize, corpus.stream.size() - pos);
+        memcpy(framer.writePtr(), &corpus.stream[pos], len);
+        framer.commit(len);
+        while (framer.next(frame)) {
+            corpus.frames.emplace_back(frame.data, frame.data + frame.len);
+        }
+    }
+    if (corpus.frames.empty()) {
+        std::cerr << "load: no valid frames in " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * registers mapped by the benchmark
+ *
+ * @return defaults with export energy, power per phase and voltage
+ */
+static ObisMap benchRegisters()
+{
+    ObisMap registers = ObisMap::defaults();
+    registers.add({ obisCode(1, 0, 2, 8, 0, 255), "Export Energy", 1000, " kWh", 1, 3 });
+    registers.add({ obisCode(1, 0, 36, 7, 0, 255), "Power L1", 1, " W", 1, 4 });
+    registers.add({ obisCode(1, 0, 56, 7, 0, 255), "Power L2", 1, " W", 1, 5 });
+    registers.add({ obisCode(1, 0, 76, 7, 0, 255), "Power L3", 1, " W", 1, 6 });
+    registers.add({ obisCode(1, 0, 32, 7, 0, 255), "Voltage L1", 1, " V", 1, 7 });
+    return registers;
+}
+
+/** main function */
+int main(int argc, char ** argv)
+{
+    /* default parameters */
+    std::string host = "";
+    int port = 1883;
+    std::chrono::milliseconds minTime(500);
+    double maxNs = 0;
+    double maxAllocs = -1;
+    std::size_t queue = 0;
+
+    /* evaluate command line parameters */
+    int c;
+    while ((c = getopt(argc, argv, "h:p:m:n:a:q:?")) != -1) {
+        switch (c) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'm':
+            minTime = std::chrono::milliseconds(atoi(optarg));
+            break;
+        case 'n':
+            maxNs = atof(optarg);
+            break;
+        case 'a':
+            maxAllocs = atof(optarg);
+            break;
+        case 'q':
+            queue = atol(optarg);
+            break;
+        case '?':
+        default:
+            std::cout << "sml2mqtt_bench [-h host] [-p port] [-m ms] [-n ns] [-a allocs] [-q capacity] corpus.sml..." << std::endl
+                << "-h: MQTT broker host name, default: none (publish fails fast)" << std::endl
+                << "-p: MQTT broker port" << std::endl
+                << "-m: minimum measurement time per stage in ms (" << minTime.count() << ")" << std::endl
+                << "-n: fail if end-to-end takes more ns per telegram" << std::endl
+                << "-a: fail if end-to-end needs more allocations per telegram" << std::endl
+                << "-q: publish from a publisher thread with a queue of capacity values" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        std::cerr << "main: no corpus files given" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /* corpus */
+    std::vector<Corpus> corpora(argc - optind);
+    size_t telegrams = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < corpora.size(); i++) {
+        if (!load(argv[optind + i], corpora[i])) {
+            return EXIT_FAILURE;
+        }
+        telegrams += corpora[i].frames.size();
+        bytes += corpora[i].stream.size();
+    }
+    printf("corpus: %zu files, %zu telegrams, %zu bytes\n", corpora.size(), telegrams, bytes);
+
+    /* MQTT client, the expected publish failures without broker are not printed */
+    std::streambuf * cerrBuf = std::cerr.rdbuf(nullptr);
+    mosquitto_lib_init();
+    mqttClient() = new MqttClient(host.c_str(), port, 0, "sml2mqtt_bench", nullptr, nullptr, false);
+    if (queue > 0) {
+        mqttClient()->startPublisher(queue, PublishQueue::Overflow::Coalesce, 0);
+    }
+
+    /* prepare the input of the later stages by decoding everything once */
+    ObisMap registers = benchRegisters();
+    std::vector<MqttClient::TopicHandle> topics;
+    for (const ObisRegister & reg : registers) {
+        topics.push_back(mqttClient()->addTopic(benchTopic + "/" + reg.topic));
+    }
+    std::vector<ObisCode> objNames;
+    std::vector<Sample> samples;
+    SmlDecoder decoder;
+    for (const Corpus & corpus : corpora) {
+        for (const std::vector<unsigned char> & frame : corpus.frames) {
+            SmlFile file;
+            if (!decoder.decode(frame.data() + 8, frame.size() - 16, file)) {
+                continue;
+            }
+            for (const SmlListResponse * list = file.lists; list != nullptr; list = list->next) {
+                for (size_t i = 0; i < list->count; i++) {
+                    const SmlEntry & entry = list->entries[i];
+                    ObisCode obis = obisCode(entry.objName.data, entry.objName.len);
+                    objNames.push_back(obis);
+                    int index = registers.indexOf(obis);
+                    if (index < 0 || (entry.type != SmlType::Integer && entry.type != SmlType::Unsigned)) {
+                        continue;
+                    }
+                    Sample sample = { index, entry.toDouble() * pow(10, entry.scaler) / registers[index].scale, "" };
+                    char buffer[32];
+                    int len = formatFixed(buffer, sizeof(buffer), sample.value, registers[index].precision);
+                    sample.payload.assign(buffer, len > 0 ? len : 0);
+                    samples.push_back(sample);
+                }
+            }
+        }
+    }
+
+    /* stages */
+    volatile uint64_t sink = 0;
+    printf("%-32s %12s %16s\n", "stage", "ns/telegram", "allocs/telegram");
+
+    SmlFramer framer;
+    framer.setVerifyCrc(false);
+    print("framing", measure(telegrams, minTime, [&]() {
+        SmlFrame frame;
+        for (const Corpus & corpus : corpora) {
+            for (size_t pos = 0; pos < corpus.stream.size(); pos += chunkSize) {
+                size_t len = std::min(chunkSize, corpus.stream.size() - pos);
+                memcpy(framer.writePtr(), &corpus.stream[pos], len);
+                framer.commit(len);
+                while (framer.next(frame)) {
+                    sink += frame.len;
+                }
+            }
+        }
+    }));
+
+    print("crc", measure(telegrams, minTime, [&]() {
+        for (const Corpus & corpus : corpora) {
+            for (const std::vector<unsigned char> & frame : corpus.frames) {
+                sink += crc16(frame.data(), frame.size() - 2);
+            }
+        }
+    }));
+
+    decoder.setVerifyCrc(false);
+    print("decode", measure(telegrams, minTime, [&]() {
+        SmlFile file;
+        for (const Corpus & corpus : corpora) {
+            for (const std::vector<unsigned char> & frame : corpus.frames) {
+                sink += decoder.decode(frame.data() + 8, frame.size() - 16, file);
+            }
+        }
+    }));
+
+    print("obis dispatch", measure(telegrams, minTime, [&]() {
+        for (ObisCode obis : objNames) {
+            sink += registers.indexOf(obis);
+        }
+    }));
+
+    print("format", measure(telegrams, minTime, [&]() {
+        char buffer[32];
+        for (const Sample & sample : samples) {
+            sink += formatFixed(buffer, sizeof(buffer), sample.value, registers[sample.index].precision);
+        }
+    }));
+
+    print("setTopic", measure(telegrams, minTime, [&]() {
+        for (const Sample & sample : samples) {
+            mqttClient()->setTopic(topics[sample.index], sample.payload);
+        }
+        mqttClient()->commit();
+    }));
+
+    Result total = { 0, 0 };
+    for (const Corpus & corpus : corpora) {
+        SML sml("", benchTopic, registers);
+        Result result = measure(corpus.frames.size(), minTime, [&]() {
+            sml.feed(corpus.stream.data(), corpus.stream.size());
+        });
+        print("end-to-end " + corpus.name.substr(corpus.name.find_last_of('/') + 1), result);
+        total.nsPerTelegram += result.nsPerTelegram * corpus.frames.size() / telegrams;
+        total.allocsPerTelegram += result.allocsPerTelegram * corpus.frames.size() / telegrams;
+    }
+    print("end-to-end", total);
+
+    delete mqttClient();
+    mqttClient() = nullptr;
+    mosquitto_lib_cleanup();
+    std::cerr.rdbuf(cerrBuf);
+
+    /* regression gate */
+    int exitCode = EXIT_SUCCESS;
+    if (maxNs > 0 && total.nsPerTelegram > maxNs) {
+        std::cerr << "main: end-to-end " << total.nsPerTelegram << " ns/telegram exceeds " << maxNs << std::endl;
+        exitCode = EXIT_FAILURE;
+    }
+    if (maxAllocs >= 0 && total.allocsPerTelegram > maxAllocs) {
+        std::cerr << "main: end-to-end " << total.allocsPerTelegram << " allocs/telegram exceeds " << maxAllocs << std::endl;
+        exitCode = EXIT_FAILURE;
+    }
+    return exitCode;
+}
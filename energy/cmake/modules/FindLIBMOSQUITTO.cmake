@@ -0,0 +1,29 @@
+find_library(LIBMOSQUITTO_LIBRARY
+	NAMES mosquitto
+	DOC "libmosquitto"
+)
+find_path(LIBMOSQUITTO_INCLUDE_DIR
+	NAMES mosquitto.h
+	DOC "libmosquitto"
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LIBMOSQUITTO
+	DEFAULT_MSG
+	LIBMOSQUITTO_LIBRARY
+	LIBMOSQUITTO_INCLUDE_DIR
+)
+
+mark_as_advanced(
+	LIBMOSQUITTO_LIBRARY
+	LIBMOSQUITTO_INCLUDE_DIR
+)
+
+if(LIBMOSQUITTO_FOUND)
+	set(LIBMOSQUITTO_LIBRARIES ${LIBMOSQUITTO_LIBRARY})
+	set(LIBMOSQUITTO_INCLUDE_DIRS ${LIBMOSQUITTO_INCLUDE_DIR})
+endif()
+
+#message(STATUS "LIBMOSQUITTO_FOUND: ${LIBMOSQUITTO_FOUND}")
+#message(STATUS "LIBMOSQUITTO_LIBRARY: ${LIBMOSQUITTO_LIBRARY}")
+#message(STATUS "LIBMOSQUITTO_INCLUDE_DIR: ${LIBMOSQUITTO_INCLUDE_DIR}")
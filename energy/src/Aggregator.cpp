@@ -0,0 +1,184 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Aggregator.h"
+
+/* C++ includes */
+#include <algorithm>
+#include <cstdlib>
+
+/** seconds of a day, the longest window */
+static const long secondsPerDay = 24 * 60 * 60;
+
+double AggregateResult::get(AggregateValue value) const
+{
+    switch (value) {
+    case AggregateValue::Delta:
+        return delta;
+    case AggregateValue::Mean:
+        return mean;
+    case AggregateValue::Min:
+        return min;
+    case AggregateValue::Max:
+        return max;
+    case AggregateValue::Count:
+    default:
+        return count;
+    }
+}
+
+Aggregator::Aggregator(std::chrono::seconds window) :
+    m_window(window),
+    m_end(0),
+    m_partial(true),
+    m_hasLast(false),
+    m_previousLast(0),
+    m_count(0),
+    m_sum(0),
+    m_min(0),
+    m_max(0),
+    m_first(0),
+    m_last(0),
+    m_result()
+{
+}
+
+bool Aggregator::add(time_t now, double value)
+{
+    bool completed = false;
+    if (m_end == 0) {
+        m_end = windowEnd(now);
+    } else
+    if (now >= m_end) {
+        /* complete the window, if it was complete and had samples */
+        if (!m_partial && m_count > 0) {
+            m_result.delta = m_last - (m_hasLast ? m_previousLast : m_first);
+            m_result.mean = m_sum / m_count;
+            m_result.min = m_min;
+            m_result.max = m_max;
+            m_result.count = m_count;
+            completed = true;
+        }
+        if (m_count > 0) {
+            m_previousLast = m_last;
+            m_hasLast = true;
+        }
+        m_partial = false;
+        m_count = 0;
+        m_end = windowEnd(now);
+    }
+
+    if (m_count == 0) {
+        m_sum = 0;
+        m_min = value;
+        m_max = value;
+        m_first = value;
+    }
+    m_count++;
+    m_sum += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_last = value;
+    return completed;
+}
+
+time_t Aggregator::windowEnd(time_t now) const
+{
+    /* the next boundary on the local wall clock, mktime() resolves DST changes */
+    struct tm local;
+    localtime_r(&now, &local);
+    long secondOfDay = local.tm_hour * 3600L + local.tm_min * 60L + local.tm_sec;
+    long window = static_cast<long>(m_window.count());
+    long end = std::min((secondOfDay / window + 1) * window, secondsPerDay);
+    if (end == secondsPerDay) {
+        local.tm_mday++;
+        end = 0;
+    }
+    local.tm_hour = static_cast<int>(end / 3600);
+    local.tm_min = static_cast<int>(end / 60 % 60);
+    local.tm_sec = static_cast<int>(end % 60);
+    local.tm_isdst = -1;
+    time_t result = mktime(&local);
+
+    /* the skipped hour of a DST change can map a boundary back to now */
+    return result > now ? result : now + 1;
+}
+
+bool Aggregator::parseWindow(const std::string & text, std::chrono::seconds & window)
+{
+    char * unit = nullptr;
+    long number = strtol(text.c_str(), &unit, 10);
+    std::string suffix(unit);
+    long factor;
+    if (suffix == "s") {
+        factor = 1;
+    } else
+    if (suffix == "m" || suffix == "min") {
+        factor = 60;
+    } else
+    if (suffix == "h") {
+        factor = 60 * 60;
+    } else
+    if (suffix == "d") {
+        factor = secondsPerDay;
+    } else {
+        return false;
+    }
+    if (number <= 0 || number * factor > secondsPerDay) {
+        return false;
+    }
+    window = std::chrono::seconds(number * factor);
+    return true;
+}
+
+bool Aggregator::parseValue(const std::string & text, AggregateValue & value)
+{
+    static const struct {
+        const char * name;
+        AggregateValue value;
+    } values[] = {
+        { "delta", AggregateValue::Delta },
+        { "mean", AggregateValue::Mean },
+        { "min", AggregateValue::Min },
+        { "max", AggregateValue::Max },
+        { "count", AggregateValue::Count }
+    };
+    for (const auto & v : values) {
+        if (text == v.name) {
+            value = v.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Aggregator::controlSuffix(std::chrono::seconds window, AggregateValue value)
+{
+    static const char * const valueNames[] = { "delta", "mean", "min", "max", "count" };
+
+    long seconds = static_cast<long>(window.count());
+    std::string suffix;
+    if (seconds % secondsPerDay == 0) {
+        suffix = std::to_string(seconds / secondsPerDay) + " d";
+    } else
+    if (seconds % 3600 == 0) {
+        suffix = std::to_string(seconds / 3600) + " h";
+    } else
+    if (seconds % 60 == 0) {
+        suffix = std::to_string(seconds / 60) + " min";
+    } else {
+        suffix = std::to_string(seconds) + " s";
+    }
+    return suffix + " " + valueNames[static_cast<int>(value)];
+}
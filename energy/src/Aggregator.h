@@ -0,0 +1,165 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C includes */
+#include <time.h>
+
+/* C++ includes */
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** value computed per aggregation window */
+enum class AggregateValue
+{
+    /** last value minus the last value of the previous window (e.g. energy per interval) */
+    Delta,
+
+    /** mean of the samples */
+    Mean,
+
+    /** smallest sample */
+    Min,
+
+    /** largest sample */
+    Max,
+
+    /** number of samples */
+    Count
+};
+
+/** aggregation of a register */
+struct AggregateConfig
+{
+    /** window lengths, at most one day */
+    std::vector<std::chrono::seconds> windows;
+
+    /** values published per window */
+    std::vector<AggregateValue> values;
+};
+
+/** result of a completed window */
+struct AggregateResult
+{
+    /** last value minus the last value of the previous window, or the first value of this one */
+    double delta;
+
+    /** mean of the samples */
+    double mean;
+
+    /** smallest sample */
+    double min;
+
+    /** largest sample */
+    double max;
+
+    /** number of samples */
+    uint64_t count;
+
+    /**
+     * get one of the values
+     *
+     * @param[in] value value
+     * @return value
+     */
+    double get(AggregateValue value) const;
+};
+
+/**
+ * Aggregates the samples of a register over windows aligned to local time.
+ *
+ * A window of e.g. 15 min ends at :00, :15, :30 and :45 local time, a window
+ * of one day at local midnight. Windows not dividing a day end at midnight
+ * as well, the repeated hour at the end of DST belongs to one window.
+ * Adding a sample is O(1); the window is completed by the first
+ * sample after its end. The window the aggregator was started in is
+ * incomplete and not reported.
+ */
+class Aggregator
+{
+public:
+    /**
+     * @param[in] window window length, at most one day
+     */
+    explicit Aggregator(std::chrono::seconds window);
+
+    /**
+     * add a sample
+     *
+     * @param[in] now time of the sample
+     * @param[in] value value
+     * @return true if the sample completed a window, its result is in result()
+     */
+    bool add(time_t now, double value);
+
+    /** result of the last completed window */
+    const AggregateResult & result() const { return m_result; }
+
+    /** window length */
+    std::chrono::seconds window() const { return m_window; }
+
+    /**
+     * parse a window length
+     *
+     * @param[in] text number with unit s, m (or min), h or d (e.g. 15m)
+     * @param[out] window window length
+     * @return false if invalid or longer than a day
+     */
+    static bool parseWindow(const std::string & text, std::chrono::seconds & window);
+
+    /**
+     * parse a value name
+     *
+     * @param[in] text delta, mean, min, max or count
+     * @param[out] value value
+     * @return false if unknown
+     */
+    static bool parseValue(const std::string & text, AggregateValue & value);
+
+    /** HomA control suffix of a window and value (e.g. "15 min mean") */
+    static std::string controlSuffix(std::chrono::seconds window, AggregateValue value);
+
+private:
+    /** end of the window containing now */
+    time_t windowEnd(time_t now) const;
+
+    /** window length */
+    std::chrono::seconds m_window;
+
+    /** end of the current window, 0 before the first sample */
+    time_t m_end;
+
+    /** the current window started before the first sample */
+    bool m_partial;
+
+    /** last value of the previous window is known */
+    bool m_hasLast;
+
+    /** last value of the previous window */
+    double m_previousLast;
+
+    /** samples of the current window */
+    uint64_t m_count;
+    double m_sum;
+    double m_min;
+    double m_max;
+    double m_first;
+    double m_last;
+
+    /** result of the last completed window */
+    AggregateResult m_result;
+};
@@ -0,0 +1,81 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Arena.h"
+
+/* C++ includes */
+#include <new>
+
+Arena::Arena(size_t blockSize) :
+    m_blocks(),
+    m_sizes(),
+    m_data(nullptr),
+    m_size(0),
+    m_used(0)
+{
+    m_data = new unsigned char[blockSize];
+    m_size = blockSize;
+    m_blocks.push_back(m_data);
+    m_sizes.push_back(m_size);
+}
+
+Arena::~Arena()
+{
+    for (unsigned char * block : m_blocks) {
+        delete[] block;
+    }
+}
+
+void Arena::reset()
+{
+    /* merge into one block of the total size */
+    if (m_blocks.size() > 1) {
+        size_t size = capacity();
+        for (unsigned char * block : m_blocks) {
+            delete[] block;
+        }
+        m_blocks.clear();
+        m_sizes.clear();
+        m_data = new unsigned char[size];
+        m_size = size;
+        m_blocks.push_back(m_data);
+        m_sizes.push_back(m_size);
+    }
+    m_used = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t size = 0;
+    for (size_t blockSize : m_sizes) {
+        size += blockSize;
+    }
+    return size;
+}
+
+void * Arena::grow(size_t size, size_t align)
+{
+    /* at least double the current block */
+    size_t blockSize = 2 * m_size;
+    while (blockSize < size + align) {
+        blockSize *= 2;
+    }
+
+    m_data = new unsigned char[blockSize];
+    m_size = blockSize;
+    m_used = 0;
+    m_blocks.push_back(m_data);
+    m_sizes.push_back(m_size);
+    return allocate(size, align);
+}
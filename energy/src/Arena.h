@@ -0,0 +1,93 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bump allocator, reset instead of freed.
+ *
+ * If an arena needed more than one block until reset(), the blocks are
+ * merged into one, so in steady state allocate() never calls malloc.
+ */
+class Arena
+{
+public:
+    /** @param[in] blockSize size of the first block */
+    explicit Arena(size_t blockSize = 4096);
+    virtual ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    /**
+     * allocate memory, valid until reset()
+     *
+     * @param[in] size size in bytes
+     * @param[in] align alignment, a power of two
+     * @return memory
+     * @throw std::bad_alloc if no block can be allocated
+     */
+    void * allocate(size_t size, size_t align)
+    {
+        uintptr_t pos = (reinterpret_cast<uintptr_t>(m_data) + m_used + align - 1) & ~static_cast<uintptr_t>(align - 1);
+        size_t used = pos - reinterpret_cast<uintptr_t>(m_data) + size;
+        if (used > m_size) {
+            return grow(size, align);
+        }
+        m_used = used;
+        return reinterpret_cast<void *>(pos);
+    }
+
+    /**
+     * allocate an array, the elements are not initialised
+     *
+     * @param[in] count number of elements
+     * @return array
+     */
+    template<typename T>
+    T * allocate(size_t count)
+    {
+        return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    /** release all allocations */
+    void reset();
+
+    /** size of all blocks */
+    size_t capacity() const;
+
+private:
+    /** allocate from a new block */
+    void * grow(size_t size, size_t align);
+
+    /** all blocks, the last one is the current */
+    std::vector<unsigned char *> m_blocks;
+
+    /** sizes of all blocks */
+    std::vector<size_t> m_sizes;
+
+    /** current block */
+    unsigned char * m_data;
+
+    /** size of current block */
+    size_t m_size;
+
+    /** used bytes of current block */
+    size_t m_used;
+};
@@ -0,0 +1,152 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Capture.h"
+
+/* C++ includes */
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+/** file magic, with format version */
+static const unsigned char captureMagic[8] = { 'S', 'M', 'L', 'C', 'A', 'P', 0x00, 0x01 };
+
+/** size of record header: time and length */
+static const size_t recordHeaderLen = 12;
+
+/** record size of raw streams */
+static const size_t rawRecordLen = 64;
+
+/** time per byte at 9600 baud, 8-N-1 */
+static const std::chrono::microseconds rawByteTime(10 * 1000000 / 9600);
+
+/**
+ * read a little endian value
+ *
+ * @param[in] data data
+ * @param[in] len number of bytes
+ * @return value
+ */
+static uint64_t readLittleEndian(const unsigned char * data, size_t len)
+{
+    uint64_t value = 0;
+    while (len--) {
+        value = (value << 8) | data[len];
+    }
+    return value;
+}
+
+/**
+ * write a little endian value
+ *
+ * @param[out] data data
+ * @param[in] value value
+ * @param[in] len number of bytes
+ */
+static void writeLittleEndian(unsigned char * data, uint64_t value, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        data[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+CaptureWriter::CaptureWriter(const std::string & file) :
+    m_file(file, std::ios::binary | std::ios::trunc),
+    m_start(),
+    m_started(false)
+{
+    if (!m_file.write(reinterpret_cast<const char *>(captureMagic), sizeof(captureMagic))) {
+        throw std::runtime_error("CaptureWriter: can't create " + file);
+    }
+}
+
+void CaptureWriter::write(const unsigned char * data, size_t len)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!m_started) {
+        m_start = now;
+        m_started = true;
+    }
+
+    unsigned char header[recordHeaderLen];
+    writeLittleEndian(header, std::chrono::duration_cast<std::chrono::microseconds>(now - m_start).count(), 8);
+    writeLittleEndian(header + 8, len, 4);
+    m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    m_file.write(reinterpret_cast<const char *>(data), len);
+
+    /* keep the capture usable if the process dies */
+    m_file.flush();
+}
+
+CaptureReader::CaptureReader(const std::string & file) :
+    m_data(),
+    m_pos(0),
+    m_raw(true),
+    m_records(0)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("CaptureReader: can't open " + file);
+    }
+    m_data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    m_raw = (m_data.size() < sizeof(captureMagic)) || (memcmp(m_data.data(), captureMagic, sizeof(captureMagic)) != 0);
+    if (m_raw) {
+        m_records = (m_data.size() + rawRecordLen - 1) / rawRecordLen;
+        return;
+    }
+
+    /* check all records once, so next() can trust the lengths */
+    for (size_t pos = sizeof(captureMagic); pos < m_data.size(); m_records++) {
+        if (m_data.size() - pos < recordHeaderLen) {
+            throw std::runtime_error("CaptureReader: truncated record in " + file);
+        }
+        size_t len = readLittleEndian(&m_data[pos + 8], 4);
+        pos += recordHeaderLen;
+        if (m_data.size() - pos < len) {
+            throw std::runtime_error("CaptureReader: truncated record in " + file);
+        }
+        pos += len;
+    }
+    rewind();
+}
+
+bool CaptureReader::next(CaptureRecord & record)
+{
+    if (m_pos >= m_data.size()) {
+        return false;
+    }
+
+    if (m_raw) {
+        /* a read returns when its last byte was received */
+        record.data = &m_data[m_pos];
+        record.len = std::min(rawRecordLen, m_data.size() - m_pos);
+        record.time = rawByteTime * (m_pos + record.len);
+    } else {
+        record.time = std::chrono::microseconds(readLittleEndian(&m_data[m_pos], 8));
+        record.len = readLittleEndian(&m_data[m_pos + 8], 4);
+        record.data = &m_data[m_pos + recordHeaderLen];
+        m_pos += recordHeaderLen;
+    }
+    m_pos += record.len;
+    return true;
+}
+
+void CaptureReader::rewind()
+{
+    m_pos = m_raw ? 0 : sizeof(captureMagic);
+}
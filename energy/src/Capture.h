@@ -0,0 +1,122 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Capture files of raw bytes received from a meter.
+ *
+ * A capture starts with the 8 byte magic "SMLCAP\0\1", followed by one
+ * record per read: time since the first record in microseconds (uint64),
+ * length (uint32), both little endian, and the bytes read.
+ */
+
+/** one read of a capture */
+struct CaptureRecord
+{
+    /** time since the first record */
+    std::chrono::microseconds time;
+
+    /** bytes read */
+    const unsigned char * data;
+
+    /** number of bytes */
+    size_t len;
+};
+
+/** record reads to a capture file */
+class CaptureWriter
+{
+public:
+    /**
+     * @param[in] file capture file, overwritten if it exists
+     * @throw std::runtime_error if the file can't be created
+     */
+    explicit CaptureWriter(const std::string & file);
+
+    /**
+     * append a record, timestamped now
+     *
+     * @param[in] data bytes read
+     * @param[in] len number of bytes
+     */
+    void write(const unsigned char * data, size_t len);
+
+private:
+    /** capture file */
+    std::ofstream m_file;
+
+    /** time of the first record */
+    std::chrono::steady_clock::time_point m_start;
+
+    /** first record was written */
+    bool m_started;
+};
+
+/**
+ * read a capture file
+ *
+ * Files without the magic are taken as raw stream (e.g. the benchmark
+ * corpus), split into records timed as received at 9600 baud.
+ */
+class CaptureReader
+{
+public:
+    /**
+     * read the whole file into memory
+     *
+     * @param[in] file capture file or raw stream
+     * @throw std::runtime_error if the file can't be read or is truncated
+     */
+    explicit CaptureReader(const std::string & file);
+
+    /**
+     * get the next record
+     *
+     * @param[out] record record, valid as long as the reader
+     * @return false at end of file
+     */
+    bool next(CaptureRecord & record);
+
+    /** start again with the first record */
+    void rewind();
+
+    /** number of records */
+    size_t records() const { return m_records; }
+
+    /** file is a raw stream */
+    bool isRaw() const { return m_raw; }
+
+private:
+    /** file content */
+    std::vector<unsigned char> m_data;
+
+    /** read position */
+    size_t m_pos;
+
+    /** no capture header */
+    bool m_raw;
+
+    /** number of records */
+    size_t m_records;
+};
@@ -0,0 +1,85 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Coroutine.h"
+
+/* C++ includes */
+#include <utility>
+
+Task::Task(Task && other) noexcept :
+    m_handle(std::exchange(other.m_handle, nullptr))
+{
+}
+
+Task & Task::operator=(Task && other) noexcept
+{
+    if (this != &other) {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+        m_handle = std::exchange(other.m_handle, nullptr);
+    }
+    return *this;
+}
+
+Task::~Task()
+{
+    if (m_handle) {
+        m_handle.destroy();
+    }
+}
+
+FdWatcher::FdWatcher(EventLoop & loop, int fd, uint32_t events) :
+    m_loop(loop),
+    m_fd(fd),
+    m_events(0),
+    m_waiter(nullptr)
+{
+    m_loop.addFd(m_fd, events, [this](uint32_t events) {
+        m_events |= events;
+        if (m_waiter) {
+            std::exchange(m_waiter, nullptr).resume();
+        }
+    });
+}
+
+FdWatcher::~FdWatcher()
+{
+    m_loop.removeFd(m_fd);
+}
+
+uint32_t FdWatcher::await_resume() noexcept
+{
+    return std::exchange(m_events, 0);
+}
+
+Ticker::Ticker(EventLoop & loop, std::chrono::milliseconds interval) :
+    m_loop(loop),
+    m_timer(-1),
+    m_expired(false),
+    m_waiter(nullptr)
+{
+    m_timer = m_loop.addTimer(interval, [this]() {
+        m_expired = true;
+        if (m_waiter) {
+            std::exchange(m_waiter, nullptr).resume();
+        }
+    });
+}
+
+Ticker::~Ticker()
+{
+    m_loop.removeTimer(m_timer);
+}
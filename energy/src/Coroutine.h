@@ -0,0 +1,139 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+
+/* project internal includes */
+#include "EventLoop.h"
+
+/**
+ * Coroutine running on an EventLoop.
+ *
+ * It starts running when called, until it awaits an FdWatcher or a
+ * Ticker; the loop resumes it from then on. An exception before the first
+ * suspension is thrown to the caller. Destroying the Task destroys a
+ * suspended coroutine, together with its watchers.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+    };
+
+    Task(Task && other) noexcept;
+    Task & operator=(Task && other) noexcept;
+    virtual ~Task();
+
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+
+    /** the coroutine has returned */
+    bool done() const { return !m_handle || m_handle.done(); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    /** coroutine, owned */
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+/**
+ * Awaitable readiness of a file descriptor.
+ *
+ * The descriptor stays watched while the watcher exists, so awaiting it
+ * again costs no system call. co_await returns the epoll events since the
+ * last co_await. One coroutine at a time may await it.
+ */
+class FdWatcher
+{
+public:
+    /**
+     * @param[in] loop event loop
+     * @param[in] fd file descriptor, not closed by the watcher
+     * @param[in] events epoll events (e.g. EPOLLIN)
+     * @throw std::system_error if epoll_ctl fails
+     */
+    FdWatcher(EventLoop & loop, int fd, uint32_t events);
+    virtual ~FdWatcher();
+
+    FdWatcher(const FdWatcher &) = delete;
+    FdWatcher & operator=(const FdWatcher &) = delete;
+
+    bool await_ready() const noexcept { return m_events != 0; }
+    void await_suspend(std::coroutine_handle<> waiter) noexcept { m_waiter = waiter; }
+    uint32_t await_resume() noexcept;
+
+private:
+    /** event loop */
+    EventLoop & m_loop;
+
+    /** file descriptor */
+    int m_fd;
+
+    /** events not yet returned by co_await */
+    uint32_t m_events;
+
+    /** suspended coroutine, nullptr if none */
+    std::coroutine_handle<> m_waiter;
+};
+
+/**
+ * Awaitable periodic timer.
+ *
+ * co_await returns after the next expiration, or at once if it expired
+ * since the last co_await.
+ */
+class Ticker
+{
+public:
+    /**
+     * @param[in] loop event loop
+     * @param[in] interval interval
+     * @throw std::system_error if the timer can't be created
+     */
+    Ticker(EventLoop & loop, std::chrono::milliseconds interval);
+    virtual ~Ticker();
+
+    Ticker(const Ticker &) = delete;
+    Ticker & operator=(const Ticker &) = delete;
+
+    bool await_ready() const noexcept { return m_expired; }
+    void await_suspend(std::coroutine_handle<> waiter) noexcept { m_waiter = waiter; }
+    void await_resume() noexcept { m_expired = false; }
+
+private:
+    /** event loop */
+    EventLoop & m_loop;
+
+    /** timer id */
+    int m_timer;
+
+    /** expired since the last co_await */
+    bool m_expired;
+
+    /** suspended coroutine, nullptr if none */
+    std::coroutine_handle<> m_waiter;
+};
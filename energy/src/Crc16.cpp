@@ -0,0 +1,69 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Crc16.h"
+
+/** lookup tables for slicing-by-8, table[k][n] is the CRC of n followed by k zero bytes */
+struct Crc16Tables
+{
+    Crc16Tables()
+    {
+        for (unsigned int n = 0; n < 256; n++) {
+            uint16_t crc = n;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+            }
+            table[0][n] = crc;
+        }
+        for (unsigned int n = 0; n < 256; n++) {
+            for (int k = 1; k < 8; k++) {
+                uint16_t crc = table[k - 1][n];
+                table[k][n] = (crc >> 8) ^ table[0][crc & 0xff];
+            }
+        }
+    }
+
+    uint16_t table[8][256];
+};
+
+/** tables, initialised on first use */
+static const Crc16Tables & tables()
+{
+    static const Crc16Tables instance;
+    return instance;
+}
+
+uint16_t crc16(const unsigned char * data, size_t len)
+{
+    const uint16_t (* t)[256] = tables().table;
+    uint16_t crc = 0xffff;
+
+    /* eight bytes per step, the two CRC bytes are folded into the first two */
+    while (len >= 8) {
+        crc ^= data[0] | (data[1] << 8);
+        crc = t[7][crc & 0xff] ^ t[6][crc >> 8] ^
+            t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^
+            t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+
+    /* remainder */
+    while (len--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+    }
+
+    return crc ^ 0xffff;
+}
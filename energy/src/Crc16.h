@@ -0,0 +1,32 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * calculate the CRC16/X-25 used by SML transport and messages
+ *
+ * Polynomial 0x1021 (reflected 0x8408), initial value and final xor 0xffff.
+ * SML transmits the CRC low byte first.
+ *
+ * @param[in] data data
+ * @param[in] len length of data
+ * @return CRC
+ */
+uint16_t crc16(const unsigned char * data, size_t len);
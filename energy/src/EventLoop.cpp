@@ -0,0 +1,242 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "EventLoop.h"
+
+/* C includes */
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+
+/** maximum number of events per epoll_wait */
+static const int maxEvents = 16;
+
+EventLoop::EventLoop() :
+    m_epollFd(-1),
+    m_eventFd(-1),
+    m_signalFd(-1),
+    m_signalMask(),
+    m_fdCallbacks(),
+    m_removedFds(),
+    m_timerFds(),
+    m_signalCallbacks(),
+    m_posted(),
+    m_postedMutex(),
+    m_stop(false)
+{
+    sigemptyset(&m_signalMask);
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0) {
+        int error = errno;
+        close(m_epollFd);
+        throw std::system_error(error, std::generic_category(), "eventfd");
+    }
+    addFd(m_eventFd, EPOLLIN, [this](uint32_t) {
+        onWakeup();
+    });
+}
+
+EventLoop::~EventLoop()
+{
+    for (int fd : m_timerFds) {
+        close(fd);
+    }
+    if (m_signalFd >= 0) {
+        close(m_signalFd);
+    }
+    close(m_eventFd);
+    close(m_epollFd);
+}
+
+void EventLoop::addFd(int fd, uint32_t events, FdCallback callback)
+{
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    }
+    m_removedFds.erase(std::remove(m_removedFds.begin(), m_removedFds.end(), fd), m_removedFds.end());
+    m_fdCallbacks[fd] = callback;
+}
+
+void EventLoop::removeFd(int fd)
+{
+    if (m_fdCallbacks.count(fd) == 0) {
+        return;
+    }
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+        std::cerr << "EventLoop::removeFd: epoll_ctl failed" << std::endl;
+    }
+
+    /* the callback might be running, erase it after dispatching */
+    m_removedFds.push_back(fd);
+}
+
+int EventLoop::addTimer(std::chrono::milliseconds interval, Callback callback)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "timerfd_create");
+    }
+
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "timerfd_settime");
+    }
+
+    addFd(fd, EPOLLIN, [fd, callback](uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            callback();
+        }
+    });
+    m_timerFds.push_back(fd);
+    return fd;
+}
+
+void EventLoop::removeTimer(int id)
+{
+    auto it = std::find(m_timerFds.begin(), m_timerFds.end(), id);
+    if (it == m_timerFds.end()) {
+        return;
+    }
+    m_timerFds.erase(it);
+    removeFd(id);
+    close(id);
+}
+
+void EventLoop::addSignal(int signum, Callback callback)
+{
+    sigaddset(&m_signalMask, signum);
+    int error = pthread_sigmask(SIG_BLOCK, &m_signalMask, nullptr);
+    if (error != 0) {
+        throw std::system_error(error, std::generic_category(), "pthread_sigmask");
+    }
+
+    int fd = signalfd(m_signalFd, &m_signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "signalfd");
+    }
+    if (m_signalFd < 0) {
+        m_signalFd = fd;
+        addFd(m_signalFd, EPOLLIN, [this](uint32_t) {
+            onSignal();
+        });
+    }
+    m_signalCallbacks[signum] = callback;
+}
+
+void EventLoop::post(Callback callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_postedMutex);
+        m_posted.push_back(callback);
+    }
+    wakeup();
+}
+
+void EventLoop::run()
+{
+    struct epoll_event events[maxEvents];
+
+    while (!m_stop) {
+        int count = epoll_wait(m_epollFd, events, maxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        }
+
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (std::find(m_removedFds.begin(), m_removedFds.end(), fd) != m_removedFds.end()) {
+                continue;
+            }
+            auto it = m_fdCallbacks.find(fd);
+            if (it != m_fdCallbacks.end()) {
+                it->second(events[i].events);
+            }
+        }
+
+        for (int fd : m_removedFds) {
+            m_fdCallbacks.erase(fd);
+        }
+        m_removedFds.clear();
+    }
+    m_stop = false;
+}
+
+void EventLoop::stop()
+{
+    m_stop = true;
+    wakeup();
+}
+
+void EventLoop::wakeup()
+{
+    uint64_t one = 1;
+    if (write(m_eventFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        std::cerr << "EventLoop::wakeup: write failed" << std::endl;
+    }
+}
+
+void EventLoop::onWakeup()
+{
+    uint64_t count;
+    if (read(m_eventFd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+
+    std::vector<Callback> posted;
+    {
+        std::lock_guard<std::mutex> lock(m_postedMutex);
+        posted.swap(m_posted);
+    }
+    for (const Callback & callback : posted) {
+        callback();
+    }
+}
+
+void EventLoop::onSignal()
+{
+    struct signalfd_siginfo info;
+    while (read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+        auto it = m_signalCallbacks.find(info.ssi_signo);
+        if (it != m_signalCallbacks.end()) {
+            it->second();
+        }
+    }
+}
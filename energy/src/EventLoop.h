@@ -0,0 +1,154 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C includes */
+#include <signal.h>
+
+/* C++ includes */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/**
+ * Non-blocking reactor based on epoll.
+ *
+ * File descriptors, timers (timerfd), signals (signalfd) and callbacks
+ * posted from other threads (eventfd) are all dispatched from run().
+ * Apart from post() and stop(), all methods must be called from the
+ * thread running the loop, or before run() is called.
+ */
+class EventLoop
+{
+public:
+    /** callback for file descriptors, gets the epoll events */
+    typedef std::function<void(uint32_t events)> FdCallback;
+
+    /** callback for timers, signals and posted work */
+    typedef std::function<void()> Callback;
+
+    /** @throw std::system_error if epoll or eventfd can't be created */
+    EventLoop();
+    virtual ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop & operator=(const EventLoop &) = delete;
+
+    /**
+     * watch a file descriptor
+     *
+     * @param[in] fd file descriptor
+     * @param[in] events epoll events (e.g. EPOLLIN)
+     * @param[in] callback called on events
+     * @throw std::system_error if epoll_ctl fails
+     */
+    void addFd(int fd, uint32_t events, FdCallback callback);
+
+    /**
+     * stop watching a file descriptor, the fd is not closed
+     *
+     * @param[in] fd file descriptor
+     */
+    void removeFd(int fd);
+
+    /**
+     * add a periodic timer
+     *
+     * @param[in] interval interval, the first expiration is after one interval
+     * @param[in] callback called on every expiration
+     * @return timer id
+     * @throw std::system_error if timerfd can't be created
+     */
+    int addTimer(std::chrono::milliseconds interval, Callback callback);
+
+    /**
+     * remove a timer
+     *
+     * @param[in] id timer id returned by addTimer
+     */
+    void removeTimer(int id);
+
+    /**
+     * handle a signal in the loop
+     *
+     * The signal is blocked for the calling thread. Call this before other
+     * threads are started, so they inherit the signal mask.
+     *
+     * @param[in] signum signal number (e.g. SIGTERM)
+     * @param[in] callback called when the signal was received
+     * @throw std::system_error if signalfd fails
+     */
+    void addSignal(int signum, Callback callback);
+
+    /**
+     * run callback in the loop thread (thread-safe)
+     *
+     * @param[in] callback callback
+     */
+    void post(Callback callback);
+
+    /** dispatch events until stop() is called */
+    void run();
+
+    /** let run() return (thread-safe) */
+    void stop();
+
+private:
+    /** wake up epoll_wait */
+    void wakeup();
+
+    /** handle eventfd readable */
+    void onWakeup();
+
+    /** handle signalfd readable */
+    void onSignal();
+
+    /** epoll file descriptor */
+    int m_epollFd;
+
+    /** eventfd for post() and stop() */
+    int m_eventFd;
+
+    /** signalfd, -1 until the first signal is added */
+    int m_signalFd;
+
+    /** blocked signals handled by m_signalFd */
+    sigset_t m_signalMask;
+
+    /** callbacks per watched file descriptor */
+    std::map<int, FdCallback> m_fdCallbacks;
+
+    /** file descriptors removed while dispatching */
+    std::vector<int> m_removedFds;
+
+    /** timer file descriptors */
+    std::vector<int> m_timerFds;
+
+    /** callbacks per signal */
+    std::map<int, Callback> m_signalCallbacks;
+
+    /** callbacks posted by post() */
+    std::vector<Callback> m_posted;
+
+    /** mutex to access m_posted */
+    std::mutex m_postedMutex;
+
+    /** run() shall return */
+    std::atomic<bool> m_stop;
+};
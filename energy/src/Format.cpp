@@ -0,0 +1,79 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Format.h"
+
+/* C++ includes */
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+/** powers of ten up to the maximum precision of the fixed point path */
+static const uint64_t powersOfTen[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/** maximum precision of the fixed point path */
+static const int maxPrecision = sizeof(powersOfTen) / sizeof(powersOfTen[0]) - 1;
+
+/** scaled values must stay below this to fit into int64_t */
+static const double maxScaled = 9.2e18;
+
+int formatFixed(char * buffer, size_t size, double value, int precision)
+{
+    /* out of the fixed point range, snprintf needs space for the null termination */
+    if ((precision < 0) || (precision > maxPrecision) || !std::isfinite(value) ||
+            (std::fabs(value) * powersOfTen[precision] >= maxScaled)) {
+        int len = snprintf(buffer, size, "%.*f", precision, value);
+        if ((len < 0) || (static_cast<size_t>(len) >= size)) {
+            return -1;
+        }
+        return len;
+    }
+
+    /* round to an integer with precision implicit decimals, half away from zero */
+    int64_t scaled = std::llround(value * powersOfTen[precision]);
+    char * pos = buffer;
+    char * end = buffer + size;
+    if (scaled < 0) {
+        if (pos == end) {
+            return -1;
+        }
+        *pos++ = '-';
+        scaled = -scaled;
+    }
+    uint64_t integer = static_cast<uint64_t>(scaled) / powersOfTen[precision];
+    uint64_t fraction = static_cast<uint64_t>(scaled) % powersOfTen[precision];
+
+    std::to_chars_result result = std::to_chars(pos, end, integer);
+    if (result.ec != std::errc()) {
+        return -1;
+    }
+    pos = result.ptr;
+
+    if (precision > 0) {
+        if (end - pos < precision + 1) {
+            return -1;
+        }
+        *pos++ = '.';
+        for (int i = precision - 1; i >= 0; i--) {
+            pos[i] = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        pos += precision;
+    }
+    return pos - buffer;
+}
@@ -0,0 +1,34 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+
+/**
+ * format a value with a fixed number of decimals
+ *
+ * Formatted with integer std::to_chars, without allocation or locale.
+ * Values are rounded half away from zero, small negative values that
+ * round to zero are formatted without sign.
+ *
+ * @param[out] buffer buffer, not null terminated
+ * @param[in] size size of buffer
+ * @param[in] value value
+ * @param[in] precision number of decimals
+ * @return length of the formatted value, or -1 if it does not fit
+ */
+int formatFixed(char * buffer, size_t size, double value, int precision);
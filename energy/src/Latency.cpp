@@ -0,0 +1,121 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Latency.h"
+
+/* C++ includes */
+#include <algorithm>
+#include <iomanip>
+
+const std::size_t LatencyHistogram::bucketCount;
+
+LatencyHistogram::LatencyHistogram() :
+    m_buckets(),
+    m_count(0),
+    m_max(0)
+{
+    for (std::atomic<uint64_t> & bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency)
+{
+    uint64_t value = latency.count() > 0 ? latency.count() : 0;
+    m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double percentile) const
+{
+    uint64_t total = count();
+    if (total == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100 * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucketCount; i++) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::chrono::nanoseconds(std::min(valueOf(i), m_max.load(std::memory_order_relaxed)));
+        }
+    }
+    return max();
+}
+
+std::size_t LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < 64) {
+        return value;
+    }
+
+    /* exponent e >= 6, the 5 bits below the leading one select the sub-bucket */
+    unsigned int e = 63 - __builtin_clzll(value);
+    std::size_t bucket = 64 + (e - 6) * 32 + ((value >> (e - 5)) & 31);
+    return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+uint64_t LatencyHistogram::valueOf(std::size_t bucket)
+{
+    if (bucket < 64) {
+        return bucket;
+    }
+    unsigned int e = (bucket - 64) / 32 + 6;
+    uint64_t sub = (bucket - 64) % 32;
+    uint64_t width = uint64_t(1) << (e - 5);
+    return (32 + sub) * width + width / 2;
+}
+
+void LatencyTracer::dump(std::ostream & out) const
+{
+    static const char * const stageNames[StageCount] = {
+        "read -> framed", "framed -> decoded", "decoded -> published", "published -> acked", "read -> acked"
+    };
+
+    /* microseconds with one decimal */
+    auto us = [](std::chrono::nanoseconds ns) {
+        return ns.count() / 1000.0;
+    };
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    for (int stage = 0; stage < StageCount; stage++) {
+        const LatencyHistogram & h = m_stages[stage];
+        out << "latency " << stageNames[stage] << ": " << h.count() << " samples";
+        if (h.count() > 0) {
+            out << ", us p50 " << us(h.percentile(50))
+                << ", p90 " << us(h.percentile(90))
+                << ", p99 " << us(h.percentile(99))
+                << ", p99.9 " << us(h.percentile(99.9))
+                << ", max " << us(h.max());
+        }
+        out << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+LatencyTracer & latencyTracer()
+{
+    static LatencyTracer tracer;
+    return tracer;
+}
@@ -0,0 +1,138 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Fixed memory latency histogram with HDR style buckets.
+ *
+ * Values below 64 ns are counted exactly, above that every power of two
+ * is split into 32 linear sub-buckets, so a percentile is accurate to about
+ * 3% from nanoseconds up to 2^42 ns (about 73 minutes). Larger values are
+ * counted in the last bucket. Updates are relaxed atomics and may come
+ * from several threads.
+ */
+class LatencyHistogram
+{
+public:
+    /** number of buckets */
+    static const std::size_t bucketCount = 64 + 36 * 32;
+
+    LatencyHistogram();
+
+    /**
+     * add a latency
+     *
+     * @param[in] latency latency, negative values count as 0
+     */
+    void record(std::chrono::nanoseconds latency);
+
+    /** number of recorded values */
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+    /** largest recorded value */
+    std::chrono::nanoseconds max() const { return std::chrono::nanoseconds(m_max.load(std::memory_order_relaxed)); }
+
+    /**
+     * get a percentile
+     *
+     * @param[in] percentile percentile (e.g. 99.9)
+     * @return value at the percentile, middle of its bucket
+     */
+    std::chrono::nanoseconds percentile(double percentile) const;
+
+private:
+    /** bucket of a value in ns */
+    static std::size_t bucketOf(uint64_t value);
+
+    /** middle of a bucket in ns */
+    static uint64_t valueOf(std::size_t bucket);
+
+    std::atomic<uint64_t> m_buckets[bucketCount];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_max;
+};
+
+/** timestamps of one telegram, CLOCK_MONOTONIC */
+struct TelegramTrace
+{
+    /** first byte of the telegram was read */
+    std::chrono::steady_clock::time_point firstByte;
+
+    /** telegram was framed */
+    std::chrono::steady_clock::time_point framed;
+
+    /** telegram was decoded */
+    std::chrono::steady_clock::time_point decoded;
+};
+
+/**
+ * Per stage latency of telegrams, from reading the first byte until the
+ * broker acknowledged the published value.
+ */
+class LatencyTracer
+{
+public:
+    /** stage */
+    enum Stage
+    {
+        /** first byte read until the frame is complete */
+        Framing,
+
+        /** frame complete until decoded */
+        Decoding,
+
+        /** decoded until publish() of a value returned */
+        Publishing,
+
+        /** publish() returned until on_publish() (PUBACK for QoS 1) */
+        Acknowledging,
+
+        /** first byte read until on_publish() */
+        Total,
+
+        StageCount
+    };
+
+    /**
+     * record the latency of a stage
+     *
+     * @param[in] stage stage
+     * @param[in] latency latency
+     */
+    void record(Stage stage, std::chrono::nanoseconds latency) { m_stages[stage].record(latency); }
+
+    /** histogram of a stage */
+    const LatencyHistogram & histogram(Stage stage) const { return m_stages[stage]; }
+
+    /**
+     * print count and percentiles of all stages
+     *
+     * @param[in] out output stream
+     */
+    void dump(std::ostream & out) const;
+
+private:
+    LatencyHistogram m_stages[StageCount];
+};
+
+/** singleton */
+LatencyTracer & latencyTracer();
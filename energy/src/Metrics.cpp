@@ -0,0 +1,319 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Metrics.h"
+
+/* C++ includes */
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+const uint64_t Histogram::bucketBounds[Histogram::bucketCount - 1] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000
+};
+
+/** write a number, integral values without exponent */
+static void writeNumber(std::ostream & out, double value)
+{
+    if (value == std::floor(value) && std::fabs(value) < 1e15) {
+        out << static_cast<int64_t>(value);
+    } else {
+        out << value;
+    }
+}
+
+/** write a quoted and escaped string, valid for JSON and OpenMetrics labels */
+static void writeString(std::ostream & out, const std::string & value)
+{
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else
+        if (c == '\n') {
+            out << "\\n";
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+Histogram::Histogram() :
+    m_buckets(),
+    m_sum(0)
+{
+    for (std::atomic<uint64_t> & bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(std::chrono::nanoseconds duration)
+{
+    uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+    std::size_t index = 0;
+    while (index < bucketCount - 1 && ns > bucketBounds[index]) {
+        index++;
+    }
+    m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const
+{
+    uint64_t count = 0;
+    for (std::size_t i = 0; i < bucketCount; i++) {
+        count += bucket(i);
+    }
+    return count;
+}
+
+double Histogram::quantile(double q) const
+{
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * total));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucketCount - 1; i++) {
+        seen += bucket(i);
+        if (seen >= rank) {
+            return bucketBounds[i] / 1e9;
+        }
+    }
+    return bucketBounds[bucketCount - 2] / 1e9;
+}
+
+Metrics::Metrics() :
+    m_families(),
+    m_mutex()
+{
+}
+
+Metrics::~Metrics()
+{
+}
+
+Counter & Metrics::counter(const std::string & name, const std::string & help, const std::string & meter, const std::string & label)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Metric & metric = find(name, help, Type::Counter, meter, label);
+    if (!metric.counter) {
+        metric.counter.reset(new Counter());
+    }
+    return *metric.counter;
+}
+
+Gauge & Metrics::gauge(const std::string & name, const std::string & help, const std::string & meter, const std::string & label)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Metric & metric = find(name, help, Type::Gauge, meter, label);
+    if (!metric.gauge) {
+        metric.gauge.reset(new Gauge());
+    }
+    return *metric.gauge;
+}
+
+Histogram & Metrics::histogram(const std::string & name, const std::string & help, const std::string & meter, const std::string & label)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Metric & metric = find(name, help, Type::Histogram, meter, label);
+    if (!metric.histogram) {
+        metric.histogram.reset(new Histogram());
+    }
+    return *metric.histogram;
+}
+
+void Metrics::callback(const std::string & name, const std::string & help, Type type, const std::string & meter, const void * owner, std::function<double()> value, const std::string & label)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Metric & metric = find(name, help, type, meter, label);
+    metric.owner = owner;
+    metric.callback = value;
+}
+
+void Metrics::remove(const void * owner)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::unique_ptr<Family> & family : m_families) {
+        std::vector<std::unique_ptr<Metric>> & metrics = family->metrics;
+        for (auto it = metrics.begin(); it != metrics.end(); ) {
+            if ((*it)->callback && (*it)->owner == owner) {
+                it = metrics.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+std::string Metrics::json() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+
+    /* {"name":value} or {"name":{"meter":value}}, histograms as {"count":..,"sum":..,"p50":..,"p99":..} */
+    auto writeValue = [&out](Type type, const Metric & metric) {
+        if (metric.callback) {
+            writeNumber(out, metric.callback());
+        } else
+        if (type == Type::Counter) {
+            out << metric.counter->value();
+        } else
+        if (type == Type::Gauge) {
+            out << metric.gauge->value();
+        } else {
+            const Histogram & histogram = *metric.histogram;
+            out << "{\"count\":" << histogram.count()
+                << ",\"sum\":" << histogram.sum() / 1e9
+                << ",\"p50\":" << histogram.quantile(0.5)
+                << ",\"p99\":" << histogram.quantile(0.99) << "}";
+        }
+    };
+
+    out << "{";
+    bool first = true;
+    for (const std::unique_ptr<Family> & family : m_families) {
+        if (family->metrics.empty()) {
+            continue;
+        }
+        out << (first ? "" : ",");
+        first = false;
+        writeString(out, family->type == Type::Counter ? family->name + "_total" : family->name);
+        out << ":";
+        if (family->metrics.size() == 1 && family->metrics.front()->meter.empty()) {
+            writeValue(family->type, *family->metrics.front());
+            continue;
+        }
+        out << "{";
+        for (std::size_t i = 0; i < family->metrics.size(); i++) {
+            out << (i ? "," : "");
+            writeString(out, family->metrics[i]->meter);
+            out << ":";
+            writeValue(family->type, *family->metrics[i]);
+        }
+        out << "}";
+    }
+    out << "}";
+    return out.str();
+}
+
+std::string Metrics::openMetrics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+
+    /* {meter="..."} with an optional additional label */
+    const Family * family = nullptr;
+    auto writeLabels = [&out, &family](const Metric & metric, const char * extra) {
+        if (metric.meter.empty() && !extra) {
+            return;
+        }
+        out << "{";
+        if (!metric.meter.empty()) {
+            out << family->label << "=";
+            writeString(out, metric.meter);
+        }
+        if (extra) {
+            out << (metric.meter.empty() ? "" : ",") << extra;
+        }
+        out << "}";
+    };
+
+    static const char * const typeNames[] = { "counter", "gauge", "histogram" };
+    for (const std::unique_ptr<Family> & f : m_families) {
+        family = f.get();
+        if (family->metrics.empty()) {
+            continue;
+        }
+        out << "# TYPE " << family->name << " " << typeNames[static_cast<int>(family->type)] << "\n";
+        out << "# HELP " << family->name << " " << family->help << "\n";
+        for (const std::unique_ptr<Metric> & metric : family->metrics) {
+            if (family->type == Type::Histogram) {
+                const Histogram & histogram = *metric->histogram;
+                uint64_t cumulative = 0;
+                for (std::size_t i = 0; i < Histogram::bucketCount; i++) {
+                    cumulative += histogram.bucket(i);
+                    std::ostringstream le;
+                    le << "le=\"";
+                    if (i < Histogram::bucketCount - 1) {
+                        le << Histogram::bucketBounds[i] / 1e9;
+                    } else {
+                        le << "+Inf";
+                    }
+                    le << "\"";
+                    out << family->name << "_bucket";
+                    writeLabels(*metric, le.str().c_str());
+                    out << " " << cumulative << "\n";
+                }
+                out << family->name << "_count";
+                writeLabels(*metric, nullptr);
+                out << " " << cumulative << "\n";
+                out << family->name << "_sum";
+                writeLabels(*metric, nullptr);
+                out << " " << histogram.sum() / 1e9 << "\n";
+                continue;
+            }
+
+            out << family->name << (family->type == Type::Counter ? "_total" : "");
+            writeLabels(*metric, nullptr);
+            out << " ";
+            if (metric->callback) {
+                writeNumber(out, metric->callback());
+            } else
+            if (family->type == Type::Counter) {
+                out << metric->counter->value();
+            } else {
+                out << metric->gauge->value();
+            }
+            out << "\n";
+        }
+    }
+    out << "# EOF\n";
+    return out.str();
+}
+
+Metrics::Metric & Metrics::find(const std::string & name, const std::string & help, Type type, const std::string & meter, const std::string & label)
+{
+    Family * family = nullptr;
+    for (std::unique_ptr<Family> & f : m_families) {
+        if (f->name == name) {
+            family = f.get();
+            break;
+        }
+    }
+    if (!family) {
+        m_families.emplace_back(new Family{ name, help, type, label, {} });
+        family = m_families.back().get();
+    }
+    if (family->type != type) {
+        throw std::invalid_argument("Metrics: " + name + " registered with another type");
+    }
+
+    for (std::unique_ptr<Metric> & metric : family->metrics) {
+        if (metric->meter == meter) {
+            return *metric;
+        }
+    }
+    family->metrics.emplace_back(new Metric{ meter, nullptr, nullptr, nullptr, nullptr, nullptr });
+    return *family->metrics.back();
+}
+
+Metrics & metrics()
+{
+    static Metrics metrics;
+    return metrics;
+}
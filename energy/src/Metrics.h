@@ -0,0 +1,225 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** monotonically increasing count, updated with relaxed atomics */
+class Counter
+{
+public:
+    Counter() : m_value(0) {}
+
+    /** add n */
+    void add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+
+    /** current value */
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+/** value that can go up and down, updated with relaxed atomics */
+class Gauge
+{
+public:
+    Gauge() : m_value(0) {}
+
+    /** set value */
+    void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+
+    /** add n, which may be negative */
+    void add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+
+    /** current value */
+    int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value;
+};
+
+/** distribution of durations in fixed buckets, updated with relaxed atomics */
+class Histogram
+{
+public:
+    /** number of buckets, the last one is unbounded */
+    static const std::size_t bucketCount = 17;
+
+    /** upper bounds of the buckets in nanoseconds, except the last one */
+    static const uint64_t bucketBounds[bucketCount - 1];
+
+    Histogram();
+
+    /**
+     * add a duration
+     *
+     * @param[in] duration duration
+     */
+    void observe(std::chrono::nanoseconds duration);
+
+    /** number of observations in a bucket, not cumulative */
+    uint64_t bucket(std::size_t index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+
+    /** number of observations */
+    uint64_t count() const;
+
+    /** sum of all observations in nanoseconds */
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+    /**
+     * estimate a quantile by the upper bound of its bucket
+     *
+     * @param[in] q quantile (e.g. 0.99)
+     * @return duration in seconds, 0 if empty
+     */
+    double quantile(double q) const;
+
+private:
+    std::atomic<uint64_t> m_buckets[bucketCount];
+    std::atomic<uint64_t> m_sum;
+};
+
+/**
+ * Registry of the daemon's metrics.
+ *
+ * Metrics are registered once, at start-up, and updated lock-free on the
+ * hot path; only registration and output take a mutex. A metric can carry
+ * a label, the meter by default. Values that are already counted elsewhere are exported
+ * by callbacks, which are called by json() and openMetrics().
+ */
+class Metrics
+{
+public:
+    /** metric type */
+    enum class Type
+    {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    Metrics();
+    virtual ~Metrics();
+
+    Metrics(const Metrics &) = delete;
+    Metrics & operator=(const Metrics &) = delete;
+
+    /**
+     * get or register a counter
+     *
+     * @param[in] name name without _total suffix (e.g. sml_bytes_read)
+     * @param[in] help description
+     * @param[in] meter label value, empty for none
+     * @param[in] label label name, the same for all metrics of a name (e.g. meter or broker)
+     * @return counter, valid for the lifetime of the registry
+     */
+    Counter & counter(const std::string & name, const std::string & help, const std::string & meter = "", const std::string & label = "meter");
+
+    /**
+     * get or register a gauge
+     *
+     * @param[in] name name
+     * @param[in] help description
+     * @param[in] meter label value, empty for none
+     * @param[in] label label name, the same for all metrics of a name (e.g. meter or broker)
+     * @return gauge, valid for the lifetime of the registry
+     */
+    Gauge & gauge(const std::string & name, const std::string & help, const std::string & meter = "", const std::string & label = "meter");
+
+    /**
+     * get or register a histogram of durations
+     *
+     * @param[in] name name, ending in _seconds
+     * @param[in] help description
+     * @param[in] meter label value, empty for none
+     * @param[in] label label name, the same for all metrics of a name (e.g. meter or broker)
+     * @return histogram, valid for the lifetime of the registry
+     */
+    Histogram & histogram(const std::string & name, const std::string & help, const std::string & meter = "", const std::string & label = "meter");
+
+    /**
+     * register a counter or gauge read by a callback
+     *
+     * @param[in] name name
+     * @param[in] help description
+     * @param[in] type Type::Counter or Type::Gauge
+     * @param[in] meter label value, empty for none
+     * @param[in] owner owner, to remove the callback by remove()
+     * @param[in] value returns the current value
+     * @param[in] label label name, the same for all metrics of a name (e.g. meter or broker)
+     */
+    void callback(const std::string & name, const std::string & help, Type type, const std::string & meter, const void * owner, std::function<double()> value, const std::string & label = "meter");
+
+    /**
+     * remove all callbacks of an owner, call it before the owner is destroyed
+     *
+     * @param[in] owner owner
+     */
+    void remove(const void * owner);
+
+    /** all metrics as JSON object, histograms with count, sum, p50 and p99 */
+    std::string json() const;
+
+    /** all metrics in OpenMetrics text format */
+    std::string openMetrics() const;
+
+private:
+    /** one time series */
+    struct Metric
+    {
+        std::string meter;
+        const void * owner;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> callback;
+    };
+
+    /** metrics sharing name, help and type */
+    struct Family
+    {
+        std::string name;
+        std::string help;
+        Type type;
+        std::string label;
+        std::vector<std::unique_ptr<Metric>> metrics;
+    };
+
+    /**
+     * find or create a metric, m_mutex must be locked
+     *
+     * @throw std::invalid_argument if the name is registered with another type
+     */
+    Metric & find(const std::string & name, const std::string & help, Type type, const std::string & meter, const std::string & label);
+
+    /** families in registration order */
+    std::vector<std::unique_ptr<Family>> m_families;
+
+    /** mutex for registration and output */
+    mutable std::mutex m_mutex;
+};
+
+/** singleton */
+Metrics & metrics();
@@ -0,0 +1,112 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "MetricsServer.h"
+
+/* C includes */
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+MetricsServer::MetricsServer(EventLoop & loop, const Metrics & metrics, const std::string & path) :
+    m_loop(loop),
+    m_metrics(metrics),
+    m_path(path),
+    m_fd(-1),
+    m_clients()
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+    }
+    unlink(path.c_str());
+    if (bind(m_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 || listen(m_fd, 8) < 0) {
+        int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::generic_category(), "bind " + path);
+    }
+    m_loop.addFd(m_fd, EPOLLIN, [this](uint32_t) {
+        onAccept();
+    });
+}
+
+MetricsServer::~MetricsServer()
+{
+    while (!m_clients.empty()) {
+        closeClient(*m_clients.begin());
+    }
+    m_loop.removeFd(m_fd);
+    close(m_fd);
+    unlink(m_path.c_str());
+}
+
+void MetricsServer::onAccept()
+{
+    for (;;) {
+        int fd = accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        m_clients.insert(fd);
+        m_loop.addFd(fd, EPOLLIN, [this, fd](uint32_t) {
+            onRequest(fd);
+        });
+    }
+}
+
+void MetricsServer::onRequest(int fd)
+{
+    /* the request itself doesn't matter, every path gets the metrics */
+    char request[1024];
+    ssize_t len = read(fd, request, sizeof(request));
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (len > 0) {
+        std::string body = m_metrics.openMetrics();
+        std::string response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "\r\n" + body;
+
+        /* small enough for the socket buffer, a slow reader gets a truncated response */
+        if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) < 0) {
+            std::cerr << "MetricsServer::onRequest: send failed" << std::endl;
+        }
+    }
+    closeClient(fd);
+}
+
+void MetricsServer::closeClient(int fd)
+{
+    m_loop.removeFd(fd);
+    close(fd);
+    m_clients.erase(fd);
+}
@@ -0,0 +1,78 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <set>
+#include <string>
+
+/* project internal includes */
+#include "EventLoop.h"
+#include "Metrics.h"
+
+/**
+ * Serves the metrics in OpenMetrics text format on a Unix socket.
+ *
+ * Every connection gets one HTTP/1.0 response after sending its request,
+ * so it can be scraped by e.g. curl --unix-socket. Runs in the event loop.
+ */
+class MetricsServer
+{
+public:
+    /**
+     * @param[in] loop event loop
+     * @param[in] metrics metrics to serve
+     * @param[in] path socket path, an existing socket is replaced
+     * @throw std::system_error if the socket can't be created
+     */
+    MetricsServer(EventLoop & loop, const Metrics & metrics, const std::string & path);
+    virtual ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer & operator=(const MetricsServer &) = delete;
+
+private:
+    /** accept pending connections */
+    void onAccept();
+
+    /**
+     * answer a request and close the connection
+     *
+     * @param[in] fd connection
+     */
+    void onRequest(int fd);
+
+    /**
+     * stop watching and close a connection
+     *
+     * @param[in] fd connection
+     */
+    void closeClient(int fd);
+
+    /** event loop */
+    EventLoop & m_loop;
+
+    /** metrics */
+    const Metrics & m_metrics;
+
+    /** socket path */
+    std::string m_path;
+
+    /** listening socket */
+    int m_fd;
+
+    /** open connections */
+    std::set<int> m_clients;
+};
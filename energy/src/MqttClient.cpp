@@ -26,102 +26,632 @@
 #include "MqttClient.h"
 
 /* C++ includes */
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
-MqttClient::MqttClient(const char * host, int port, int qos, const char * baseTopic, const char * id, const char * username, const char * password, bool verbose) :
-    mosqpp::mosquittopp(id),
-    m_verbose(verbose),
+/* project internal includes */
+#include "Format.h"
+
+/** suffix of backfill topics, including the terminating zero */
+static const char backfillSuffix[] = "/backfill";
+
+/** the warm-up ends when no retained message arrived for this long */
+static const std::chrono::milliseconds warmUpQuiet(100);
+
+MqttClient::MqttClient(const char * host, int port, int qos, const char * id, const char * username, const char * password, bool verbose, const std::string & name, int version, unsigned int maxInflight) :
+    m_mosq(mosquitto_new(id, true, this)),
+    m_host(host),
+    m_port(port),
+    m_version(version),
+    m_hasConnected(false),
+    m_fallBackMutex(),
+    m_stopping(false),
+    m_fallBack(),
+    m_name(name),
     m_qos(qos),
-    m_baseTopic(baseTopic),
-    m_topicPayloads(),
-    m_topicPayloadsMutex()
+    m_verbose(verbose),
+    m_topics(),
+    m_connected(false),
+    m_session(0),
+    m_aliasMaximum(0),
+    m_aliasSession(0),
+    m_nextAlias(1),
+    m_aliases(m_topics.capacity(), 0),
+    m_expiry(m_topics.capacity(), 0),
+    m_topicQos(m_topics.capacity(), -1),
+    m_topicRetain(m_topics.capacity(), 1),
+    m_maxInflight(maxInflight),
+    m_maxQueued(0),
+    m_spool(nullptr),
+    m_offlinePayloads(m_topics.capacity()),
+    m_offlineHandles(),
+    m_reconnected(false),
+    m_publishes(metrics().counter("mqtt_publishes", "publishes attempted", name, "broker")),
+    m_publishFailures(metrics().counter("mqtt_publish_failures", "publishes failed", name, "broker")),
+    m_publishSuppressed(metrics().counter("mqtt_publishes_suppressed", "publishes suppressed because the payload was unchanged", name, "broker")),
+    m_queueDepth(metrics().gauge("mqtt_queue_depth", "messages passed to libmosquitto and not yet sent or acknowledged", name, "broker")),
+    m_inflightExhausted(metrics().counter("mqtt_inflight_exhausted", "QoS 1/2 publishes queued by libmosquitto as the in-flight window was full", name, "broker")),
+    m_inflight(0),
+    m_inflightMids(),
+    m_queueFull(metrics().counter("mqtt_queue_full", "publishes dropped or spooled as the libmosquitto queue was full", name, "broker")),
+    m_publishDuration(metrics().histogram("mqtt_publish_duration_seconds", "duration of a publish call", name, "broker")),
+    m_trace(nullptr),
+    m_queue(),
+    m_item(),
+    m_mirrors(),
+    m_mirrorHandles(),
+    m_warmUpMutex(),
+    m_warmUpChanged(),
+    m_warmUp(WarmUp::Off),
+    m_warmUpTopics(),
+    m_warmUpAcks(0),
+    m_warmUpRetained(0),
+    m_warmUpLast(),
+    m_pendingAcks()
 {
+    if (!m_mosq) {
+        throw std::runtime_error("MqttClient::MqttClient: mosquitto_new failed");
+    }
+    for (PendingAck & ack : m_pendingAcks) {
+        ack.mid.store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint64_t> & mids : m_inflightMids) {
+        mids.store(0, std::memory_order_relaxed);
+    }
+    metrics().callback("mqtt_inflight", "QoS 1/2 messages passed to libmosquitto and not yet acknowledged", Metrics::Type::Gauge, m_name, this, [this]() { return m_inflight.load(std::memory_order_relaxed); }, "broker");
+    mosquitto_connect_v5_callback_set(m_mosq, connectCallback);
+    mosquitto_disconnect_callback_set(m_mosq, disconnectCallback);
+    mosquitto_publish_callback_set(m_mosq, publishCallback);
+    mosquitto_message_callback_set(m_mosq, messageCallback);
+    mosquitto_subscribe_callback_set(m_mosq, subscribeCallback);
+    if (mosquitto_opts_set(m_mosq, MOSQ_OPT_PROTOCOL_VERSION, &version) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::MqttClient: protocol version " << version << " not supported" << std::endl;
+    }
+    if (mosquitto_max_inflight_messages_set(m_mosq, maxInflight) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::MqttClient: max_inflight_messages_set failed" << std::endl;
+    }
+
     /* set last will */
     /*
     std::string topic = m_baseTopic + "/$state";
     std::string payload = "lost";
-    if (will_set(topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_will_set(m_mosq, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::MqttClient: will_set failed" << std::endl;
     }
     */
 
     /* username/password */
-    if (username_pw_set(username, password) != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_username_pw_set(m_mosq, username, password) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::MqttClient: username_pw_set failed" << std::endl;
     }
 
     /* connect */
-    if (connect_async(host, port) != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_connect_async(m_mosq, host, port, 60) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::MqttClient: connect_async failed" << std::endl;
     }
-    if (loop_start() != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_loop_start(m_mosq) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::MqttClient: loop_start failed" << std::endl;
     }
 }
 
 MqttClient::~MqttClient()
 {
+    /* publish what is queued before disconnecting */
+    metrics().remove(this);
+    m_queue.reset();
+    {
+        std::lock_guard<std::mutex> lock(m_fallBackMutex);
+        m_stopping = true;
+    }
+    if (m_fallBack.joinable()) {
+        m_fallBack.join();
+    }
+
     /* disconnect */
     /*
     std::string topic = m_baseTopic + "/$state";
     std::string payload = "disconnected";
-    if (publish(nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_publish(m_mosq, nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::~MqttClient: publish failed" << std::endl;
     }
     */
-    if (disconnect() != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_disconnect(m_mosq) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::~MqttClient: disconnect failed" << std::endl;
     }
-    if (loop_stop() != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_loop_stop(m_mosq, false) != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::~MqttClient: loop_stop failed" << std::endl;
     }
+    mosquitto_destroy(m_mosq);
+}
+
+int MqttClient::parseVersion(const std::string & name)
+{
+    if (name == "3.1.1") {
+        return MQTT_PROTOCOL_V311;
+    } else
+    if (name == "5") {
+        return MQTT_PROTOCOL_V5;
+    }
+    throw std::invalid_argument("unknown MQTT version " + name);
+}
+
+MqttClient::TopicHandle MqttClient::addTopic(const std::string & topic)
+{
+    TopicHandle handle = m_topics.insert(topic);
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        m_mirrorHandles[i][handle] = m_mirrors[i]->addTopic(topic);
+    }
+    return handle;
+}
+
+void MqttClient::addMirror(MqttClient * mirror)
+{
+    m_mirrors.push_back(mirror);
+    m_mirrorHandles.emplace_back(m_topics.capacity(), TopicCache::npos);
+}
+
+void MqttClient::setTrace(const TelegramTrace * trace)
+{
+    m_trace = trace;
+    for (MqttClient * mirror : m_mirrors) {
+        mirror->setTrace(trace);
+    }
+}
+
+void MqttClient::setTopic(TopicHandle handle, std::string_view payload, bool force)
+{
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        m_mirrors[i]->setTopic(m_mirrorHandles[i][handle], payload, force);
+    }
+    if (!m_queue) {
+        publishTopic(handle, payload, force, false, m_trace);
+        return;
+    }
+    m_item.isValue = false;
+    m_item.payload.assign(payload.data(), payload.size());
+    queueItem(handle, force);
+}
+
+void MqttClient::setTopic(TopicHandle handle, double value, int precision, bool force)
+{
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        m_mirrors[i]->setTopic(m_mirrorHandles[i][handle], value, precision, force);
+    }
+    if (!m_queue) {
+        publishValue(handle, value, precision, force, m_trace);
+        return;
+    }
+    m_item.isValue = true;
+    m_item.value = value;
+    m_item.precision = precision;
+    queueItem(handle, force);
+}
+
+void MqttClient::setTopic(const std::string & topic, std::string_view payload)
+{
+    setTopic(addTopic(topic), payload);
+    commit();
+}
+
+void MqttClient::setExpiry(TopicHandle handle, uint32_t seconds)
+{
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        m_mirrors[i]->setExpiry(m_mirrorHandles[i][handle], seconds);
+    }
+    m_expiry[handle] = seconds;
+}
+
+void MqttClient::setDelivery(TopicHandle handle, int qos, bool retain)
+{
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        m_mirrors[i]->setDelivery(m_mirrorHandles[i][handle], qos, retain);
+    }
+    m_topicQos[handle] = qos;
+    m_topicRetain[handle] = retain;
 }
 
-void MqttClient::setTopic(std::string topic, std::string payload)
+void MqttClient::startPublisher(std::size_t capacity, PublishQueue::Overflow overflow, std::size_t backfillPerTick, std::chrono::milliseconds backfillInterval)
 {
-    std::lock_guard<std::mutex> lock(m_topicPayloadsMutex);
+    EventLoop::Callback idle;
+    if (backfillPerTick > 0) {
+        idle = [this, backfillPerTick]() { backfill(backfillPerTick); };
+    }
+    m_queue.reset(new PublishQueue(m_name, capacity, m_topics.capacity(), overflow, [this](const PublishItem & item) {
+        const TelegramTrace * trace = item.traced ? &item.trace : nullptr;
+        if (item.isValue) {
+            publishValue(item.handle, item.value, item.precision, item.force, trace);
+        } else {
+            publishTopic(item.handle, item.payload, item.force, false, trace);
+        }
+    }, idle, backfillInterval));
+    metrics().callback("publish_queue_depth", "items waiting for the publisher thread", Metrics::Type::Gauge, m_name, this, [this]() { return m_queue->depth(); }, "broker");
+}
+
+void MqttClient::commit()
+{
+    for (MqttClient * mirror : m_mirrors) {
+        mirror->commit();
+    }
+    if (m_queue) {
+        m_queue->commit();
+    }
+}
+
+void MqttClient::queueItem(TopicHandle handle, bool force)
+{
+    m_item.handle = handle;
+    m_item.force = force;
+    m_item.traced = (m_trace != nullptr);
+    if (m_trace) {
+        m_item.trace = *m_trace;
+    }
+    m_queue->push(m_item);
+}
+
+void MqttClient::publishValue(TopicHandle handle, double value, int precision, bool force, const TelegramTrace * trace)
+{
+    char payload[32];
+    int len = formatFixed(payload, sizeof(payload), value, precision);
+    if (len < 0) {
+        return;
+    }
+    publishTopic(handle, std::string_view(payload, len), force, true, trace);
+}
+
+std::size_t MqttClient::backfill(std::size_t max)
+{
+    std::size_t count = 0;
+    SpoolRecord record;
+    char topic[Spool::maxData + sizeof(backfillSuffix)];
+    char payload[Spool::maxData + 48];
+
+    while (m_spool && m_connected.load(std::memory_order_relaxed) && count < max && m_spool->front(record)) {
+        /* topic + "/backfill" */
+        memcpy(topic, record.topic.data(), record.topic.size());
+        memcpy(topic + record.topic.size(), backfillSuffix, sizeof(backfillSuffix));
+
+        /* {"time":<ms>,"value":<value>}, spooled values are formatted numbers */
+        char * p = payload;
+        char * end = payload + sizeof(payload);
+        memcpy(p, "{\"time\":", 8);
+        p = std::to_chars(p + 8, end, record.time / 1000).ptr;
+        memcpy(p, ",\"value\":", 9);
+        p += 9;
+        memcpy(p, record.payload.data(), record.payload.size());
+        p += record.payload.size();
+        *p++ = '}';
+
+        m_publishes.add();
+        m_queueDepth.add(1);
+        int mid = 0;
+        if (mosquitto_publish(m_mosq, &mid, topic, p - payload, payload, m_qos, false) != MOSQ_ERR_SUCCESS) {
+            m_queueDepth.add(-1);
+            m_publishFailures.add();
+            break;
+        }
+        trackInflight(mid, m_qos);
+        m_spool->pop();
+        count++;
+    }
+    return count;
+}
+
+void MqttClient::publishTopic(TopicHandle handle, std::string_view payload, bool force, bool spool, const TelegramTrace * trace)
+{
+    /* payloads kept while offline go out first */
+    if (m_reconnected.load(std::memory_order_relaxed) && m_reconnected.exchange(false, std::memory_order_acquire)) {
+        publishOffline();
+    }
 
     /* check if value has changed */
-    if (m_topicPayloads[topic] == payload) {
+    if (!m_topics.update(handle, payload) && !force) {
+        m_publishSuppressed.add();
+        return;
+    }
+
+    /* spool while offline, the library would queue without limit */
+    const std::string & topic = m_topics.topic(handle);
+    bool connected = m_connected.load(std::memory_order_relaxed);
+    if (spool && !m_spool && !connected) {
+        /* without a spool, only the latest value is published after reconnect */
+        m_topics.invalidate(handle);
+        return;
+    }
+    if (!spool && !connected) {
+        /* a payload (e.g. a snapshot of every telegram) would be queued by the library */
+        keepOffline(handle, payload);
+        return;
+    }
+    spool = spool && m_spool;
+    if (spool && !connected) {
+        spoolValue(handle, payload);
+        return;
+    }
+
+    /* libmosquitto queues without limit, and sends no more than maxInflight QoS 1/2 messages at once */
+    int qos = (m_topicQos[handle] < 0) ? m_qos : m_topicQos[handle];
+    bool retain = m_topicRetain[handle];
+    if (m_maxQueued > 0 && m_queueDepth.value() >= static_cast<int64_t>(m_maxQueued)) {
+        m_queueFull.add();
+        if (spool) {
+            spoolValue(handle, payload);
+        } else {
+            m_topics.invalidate(handle);
+        }
         return;
     }
-    m_topicPayloads[topic] = payload;
+    if (qos > 0 && m_maxInflight > 0 && m_inflight.load(std::memory_order_relaxed) >= m_maxInflight) {
+        m_inflightExhausted.add();
+    }
 
     /* publish */
-    topic = m_baseTopic + "/" + topic;
-    if (publish(nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+    /* queue depth is raised first, on_publish() may run before publish() returns */
+    m_publishes.add();
+    m_queueDepth.add(1);
+    int mid = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int rc;
+    if (m_version.load(std::memory_order_relaxed) == MQTT_PROTOCOL_V5) {
+        rc = publishV5(&mid, handle, payload, qos, retain);
+    } else {
+        rc = mosquitto_publish(m_mosq, &mid, topic.c_str(), payload.size(), payload.data(), qos, retain);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    m_publishDuration.observe(end - start);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        trackInflight(mid, qos);
+    }
+    if (rc == MOSQ_ERR_SUCCESS && trace) {
+        /* the ack may already be lost if on_publish() ran before publish() returned */
+        latencyTracer().record(LatencyTracer::Publishing, end - trace->decoded);
+        PendingAck & ack = m_pendingAcks[mid % m_pendingAcks.size()];
+        ack.firstByte.store(trace->firstByte.time_since_epoch().count(), std::memory_order_relaxed);
+        ack.published.store(end.time_since_epoch().count(), std::memory_order_relaxed);
+        ack.mid.store(mid, std::memory_order_release);
+    }
+    if (rc != MOSQ_ERR_SUCCESS) {
+        m_queueDepth.add(-1);
+        m_publishFailures.add();
         std::cerr << "MqttClient::publishOnChange: publish failed" << std::endl;
+        if (spool) {
+            spoolValue(handle, payload);
+        }
     }
     if (m_verbose) {
         std::cout << topic << " set to " << payload << std::endl;
     }
 }
 
-std::string MqttClient::getTopic(std::string topic, std::string defaultValue) const
+int MqttClient::publishV5(int * mid, TopicHandle handle, std::string_view payload, int qos, bool retain)
 {
-    std::lock_guard<std::mutex> lock(m_topicPayloadsMutex);
+    mosquitto_property * properties = nullptr;
+    const char * topic = m_topics.topic(handle).c_str();
+    if (m_expiry[handle] > 0) {
+        mosquitto_property_add_int32(&properties, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, m_expiry[handle]);
+    }
+
+    /*
+     * topic aliases with QoS 0 only, libmosquitto sends QoS 1 messages
+     * again after a reconnect, where their alias is unknown
+     */
+    bool announce = false;
+    if (qos == 0) {
+        uint32_t session = m_session.load(std::memory_order_acquire);
+        if (session != m_aliasSession) {
+            std::fill(m_aliases.begin(), m_aliases.end(), 0);
+            m_nextAlias = 1;
+            m_aliasSession = session;
+        }
+        uint16_t alias = m_aliases[handle];
+        if (alias != 0) {
+            /* the broker knows the topic */
+            topic = nullptr;
+        } else
+        if (m_nextAlias <= m_aliasMaximum.load(std::memory_order_relaxed)) {
+            /* send topic and alias once */
+            alias = m_nextAlias++;
+            m_aliases[handle] = alias;
+            announce = true;
+        }
+        if (alias != 0) {
+            mosquitto_property_add_int16(&properties, MQTT_PROP_TOPIC_ALIAS, alias);
+        }
+    }
 
-    try {
-        return m_topicPayloads.at(topic);
-    } catch (std::out_of_range & e) {
-        return defaultValue;
+    int rc = mosquitto_publish_v5(m_mosq, mid, topic, payload.size(), payload.data(), qos, retain, properties);
+    mosquitto_property_free_all(&properties);
+    if (rc != MOSQ_ERR_SUCCESS && announce) {
+        /* announce the topic again with the next alias */
+        m_aliases[handle] = 0;
     }
+    return rc;
 }
 
-void MqttClient::on_connect(int rc)
+void MqttClient::trackInflight(int mid, int qos)
+{
+    uint64_t bit = uint64_t(1) << (mid % 64);
+    std::atomic<uint64_t> & mids = m_inflightMids[(mid / 64) % m_inflightMids.size()];
+    if (qos > 0) {
+        if (!(mids.fetch_or(bit, std::memory_order_relaxed) & bit)) {
+            m_inflight.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else
+    if (mids.fetch_and(~bit, std::memory_order_relaxed) & bit) {
+        /* left from a QoS 1/2 message acknowledged before it was counted */
+        m_inflight.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void MqttClient::spoolValue(TopicHandle handle, std::string_view payload)
+{
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!m_spool->push(now, m_topics.topic(handle), payload)) {
+        std::cerr << "MqttClient::spoolValue: " << m_topics.topic(handle) << " too long for spool" << std::endl;
+    }
+
+    /* publish the current value again after reconnect */
+    m_topics.invalidate(handle);
+}
+
+void MqttClient::keepOffline(TopicHandle handle, std::string_view payload)
+{
+    if (std::find(m_offlineHandles.begin(), m_offlineHandles.end(), handle) == m_offlineHandles.end()) {
+        m_offlineHandles.push_back(handle);
+    }
+    m_offlinePayloads[handle].assign(payload.data(), payload.size());
+
+    /* publish the latest payload after reconnect, even if unchanged */
+    m_topics.invalidate(handle);
+}
+
+void MqttClient::publishOffline()
+{
+    /* a payload is kept again if the connection is lost meanwhile */
+    std::vector<TopicHandle> handles;
+    handles.swap(m_offlineHandles);
+    for (TopicHandle handle : handles) {
+        std::string payload = std::move(m_offlinePayloads[handle]);
+        m_offlinePayloads[handle].clear();
+        publishTopic(handle, payload, true, false, nullptr);
+    }
+}
+
+std::size_t MqttClient::warmUp(const std::vector<std::string> & topics, std::chrono::milliseconds timeout)
+{
+    /* all brokers in parallel */
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    for (MqttClient * mirror : m_mirrors) {
+        mirror->beginWarmUp(topics);
+    }
+    beginWarmUp(topics);
+    std::size_t retained = endWarmUp(deadline);
+    for (MqttClient * mirror : m_mirrors) {
+        mirror->endWarmUp(deadline);
+    }
+    return retained;
+}
+
+void MqttClient::beginWarmUp(const std::vector<std::string> & topics)
+{
+    std::lock_guard<std::mutex> lock(m_warmUpMutex);
+    m_warmUpTopics = topics;
+    m_warmUpRetained = 0;
+    m_warmUp = WarmUp::Pending;
+
+    /* otherwise on_connect() subscribes, it sets m_connected before locking */
+    if (m_connected.load(std::memory_order_relaxed)) {
+        subscribeWarmUp();
+    }
+}
+
+void MqttClient::subscribeWarmUp()
+{
+    m_warmUp = WarmUp::Subscribing;
+    m_warmUpAcks = m_warmUpTopics.size();
+    for (const std::string & topic : m_warmUpTopics) {
+        if (mosquitto_subscribe(m_mosq, nullptr, topic.c_str(), m_qos) != MOSQ_ERR_SUCCESS) {
+            std::cerr << "MqttClient::subscribeWarmUp: subscribe('" << topic << "') failed" << std::endl;
+            m_warmUpAcks--;
+        }
+    }
+    if (m_warmUpAcks == 0) {
+        m_warmUp = WarmUp::Receiving;
+        m_warmUpLast = std::chrono::steady_clock::now();
+    }
+}
+
+std::size_t MqttClient::endWarmUp(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(m_warmUpMutex);
+    for (;;) {
+        /* retained messages follow the SUBACK, wait until they stop */
+        std::chrono::steady_clock::time_point until = deadline;
+        if (m_warmUp == WarmUp::Receiving) {
+            until = std::min(deadline, m_warmUpLast + warmUpQuiet);
+        }
+        if (std::chrono::steady_clock::now() >= until) {
+            break;
+        }
+        m_warmUpChanged.wait_until(lock, until);
+    }
+    if (m_warmUp == WarmUp::Subscribing || m_warmUp == WarmUp::Receiving) {
+        for (const std::string & topic : m_warmUpTopics) {
+            if (mosquitto_unsubscribe(m_mosq, nullptr, topic.c_str()) != MOSQ_ERR_SUCCESS) {
+                std::cerr << "MqttClient::endWarmUp: unsubscribe('" << topic << "') failed" << std::endl;
+            }
+        }
+    }
+    m_warmUp = WarmUp::Off;
+    return m_warmUpRetained;
+}
+
+void MqttClient::fallBack()
+{
+    /* the loop thread has stopped on the protocol error, or stops on disconnect */
+    mosquitto_disconnect(m_mosq);
+    if (mosquitto_loop_stop(m_mosq, false) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::fallBack: loop_stop failed" << std::endl;
+    }
+    int version = MQTT_PROTOCOL_V311;
+    m_version.store(version, std::memory_order_relaxed);
+    if (mosquitto_opts_set(m_mosq, MOSQ_OPT_PROTOCOL_VERSION, &version) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::fallBack: opts_set failed" << std::endl;
+    }
+    if (mosquitto_connect_async(m_mosq, m_host.c_str(), m_port, 60) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::fallBack: connect_async failed" << std::endl;
+    }
+    if (mosquitto_loop_start(m_mosq) != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::fallBack: loop_start failed" << std::endl;
+    }
+}
+
+void MqttClient::on_connect(int rc, const mosquitto_property * properties)
 {
     std::string topic;
     std::string payload;
 
     if (rc != MOSQ_ERR_SUCCESS) {
         std::cerr << "MqttClient::on_connect(" << rc << ")" << std::endl;
+
+        /* MQTT 3.x broker, libmosquitto reports its CONNACK as unsupported protocol version */
+        bool refused = (rc == MQTT_RC_UNSUPPORTED_PROTOCOL_VERSION || rc == CONNACK_REFUSED_PROTOCOL_VERSION);
+        if (refused && !m_hasConnected && m_version.load(std::memory_order_relaxed) == MQTT_PROTOCOL_V5) {
+            std::lock_guard<std::mutex> lock(m_fallBackMutex);
+            if (!m_stopping && !m_fallBack.joinable()) {
+                std::cerr << "MqttClient::on_connect: " << m_host << " refused MQTT 5, falling back to 3.1.1" << std::endl;
+                m_fallBack = std::thread(&MqttClient::fallBack, this);
+            }
+        }
     } else {
+        /* topic aliases of the last connection are invalid */
+        uint16_t aliasMaximum = 0;
+        if (properties) {
+            mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &aliasMaximum, false);
+        }
+        m_aliasMaximum.store(aliasMaximum, std::memory_order_relaxed);
+        m_session.fetch_add(1, std::memory_order_release);
+        m_hasConnected = true;
+        m_connected.store(true, std::memory_order_relaxed);
+        m_reconnected.store(true, std::memory_order_release);
+
+        /* warm-up waiting for the connection */
+        {
+            std::lock_guard<std::mutex> lock(m_warmUpMutex);
+            if (m_warmUp == WarmUp::Pending) {
+                subscribeWarmUp();
+            }
+        }
+
         /* publish $state = init */
         /* not used
         topic = m_baseTopic + "/$state";
         payload = "init";
-        if (publish(nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+        if (mosquitto_publish(m_mosq, nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
             std::cerr << "MqttClient::on_connect: publish('" << topic << "', '" << payload << "') failed" << std::endl;
         }
         */
@@ -130,7 +660,7 @@ void MqttClient::on_connect(int rc)
         /* not used by HomA
         topic = m_baseTopic + "/$name";
         payload = "SML";
-        if (publish(nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+        if (mosquitto_publish(m_mosq, nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
             std::cerr << "MqttClient::on_connect: publish('" << topic << "', '" << payload << "') failed" << std::endl;
         }
         */
@@ -138,7 +668,7 @@ void MqttClient::on_connect(int rc)
         /* subscribe */
         /* not used by HomA
         topic = m_baseTopic + "/" + m_subscribeTopic;
-        if (subscribe(nullptr, topic.c_str(), m_qos) != MOSQ_ERR_SUCCESS) {
+        if (mosquitto_subscribe(m_mosq, nullptr, topic.c_str(), m_qos) != MOSQ_ERR_SUCCESS) {
             std::cerr << "MqttClient::on_connect: subscribe failed" << std::endl;
         }
         */
@@ -147,24 +677,103 @@ void MqttClient::on_connect(int rc)
     	/* not used
         topic = m_baseTopic + "/$state";
         payload = "ready";
-        if (publish(nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
+        if (mosquitto_publish(m_mosq, nullptr, topic.c_str(), payload.length(), payload.c_str(), m_qos, true) != MOSQ_ERR_SUCCESS) {
             std::cerr << "MqttClient::on_connect: publish('" << topic << "', '" << payload << "') failed" << std::endl;
         }
         */
     }
 }
 
+void MqttClient::on_disconnect(int rc)
+{
+    m_connected.store(false, std::memory_order_relaxed);
+    m_session.fetch_add(1, std::memory_order_release);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MqttClient::on_disconnect(" << rc << ")" << std::endl;
+    }
+
+    /* subscribe again on reconnect, the subscriptions are lost with a clean session */
+    std::lock_guard<std::mutex> lock(m_warmUpMutex);
+    if (m_warmUp == WarmUp::Subscribing || m_warmUp == WarmUp::Receiving) {
+        m_warmUp = WarmUp::Pending;
+        m_warmUpChanged.notify_all();
+    }
+}
+
+void MqttClient::on_publish(int mid)
+{
+    m_queueDepth.add(-1);
+    uint64_t bit = uint64_t(1) << (mid % 64);
+    if (m_inflightMids[(mid / 64) % m_inflightMids.size()].fetch_and(~bit, std::memory_order_relaxed) & bit) {
+        m_inflight.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /* traced message, called on PUBACK for QoS 1, PUBCOMP for QoS 2 and after sending for QoS 0 */
+    PendingAck & ack = m_pendingAcks[mid % m_pendingAcks.size()];
+    int expected = mid;
+    if (mid != 0 && ack.mid.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+        std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+        latencyTracer().record(LatencyTracer::Acknowledging, now - std::chrono::steady_clock::duration(ack.published.load(std::memory_order_relaxed)));
+        latencyTracer().record(LatencyTracer::Total, now - std::chrono::steady_clock::duration(ack.firstByte.load(std::memory_order_relaxed)));
+    }
+}
+
 void MqttClient::on_message(const struct mosquitto_message * message)
 {
-    std::lock_guard<std::mutex> lock(m_topicPayloadsMutex);
+    /* remember retained values of own topics, to not publish them again */
+    std::lock_guard<std::mutex> lock(m_warmUpMutex);
+    TopicHandle handle = m_topics.find(message->topic);
+    if (handle == TopicCache::npos && message->retain && m_warmUp != WarmUp::Off) {
+        /* topics not added yet, like the meta topics, are known from now on */
+        try {
+            handle = m_topics.insert(message->topic);
+        } catch (std::length_error & e) {
+            std::cerr << "MqttClient::on_message: " << e.what() << std::endl;
+        }
+    }
+    if (handle != TopicCache::npos) {
+        m_topics.update(handle, std::string_view(static_cast<const char *>(message->payload), message->payloadlen));
+    }
+    if (message->retain && m_warmUp != WarmUp::Off) {
+        m_warmUpRetained++;
+        m_warmUpLast = std::chrono::steady_clock::now();
+    }
+}
+
+void MqttClient::on_subscribe()
+{
+    /* the retained messages of a subscription follow its SUBACK */
+    std::lock_guard<std::mutex> lock(m_warmUpMutex);
+    if (m_warmUp == WarmUp::Subscribing && --m_warmUpAcks == 0) {
+        m_warmUp = WarmUp::Receiving;
+        m_warmUpLast = std::chrono::steady_clock::now();
+        m_warmUpChanged.notify_all();
+    }
+}
+
+void MqttClient::connectCallback(struct mosquitto * /* mosq */, void * obj, int rc, int /* flags */, const mosquitto_property * properties)
+{
+    static_cast<MqttClient *>(obj)->on_connect(rc, properties);
+}
+
+void MqttClient::disconnectCallback(struct mosquitto * /* mosq */, void * obj, int rc)
+{
+    static_cast<MqttClient *>(obj)->on_disconnect(rc);
+}
+
+void MqttClient::publishCallback(struct mosquitto * /* mosq */, void * obj, int mid)
+{
+    static_cast<MqttClient *>(obj)->on_publish(mid);
+}
 
-    /* remove basetopic from topic */
-    std::string topic = message->topic;
-    topic.erase(0, m_baseTopic.length()+1);
+void MqttClient::messageCallback(struct mosquitto * /* mosq */, void * obj, const struct mosquitto_message * message)
+{
+    static_cast<MqttClient *>(obj)->on_message(message);
+}
 
-    /* save it */
-    std::string payload(static_cast<const char *>(message->payload), message->payloadlen);
-    m_topicPayloads[topic] = payload;
+void MqttClient::subscribeCallback(struct mosquitto * /* mosq */, void * obj, int /* mid */, int /* qos_count */, const int * /* granted_qos */)
+{
+    static_cast<MqttClient *>(obj)->on_subscribe();
 }
 
 MqttClient * & mqttClient()
@@ -21,38 +21,260 @@
 
 #pragma once
 
+/* C includes */
+#include <mosquitto.h>
+
 /* C++ includes */
-#include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <mosquittopp.h>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/* project internal includes */
+#include "Latency.h"
+#include "Metrics.h"
+#include "PublishQueue.h"
+#include "Spool.h"
+#include "TopicCache.h"
 
-class MqttClient : private mosqpp::mosquittopp
+class MqttClient
 {
 public:
-    MqttClient(const char * host, int port, int qos, const char * baseTopic, const char * id, const char * username, const char * password, bool verbose = false);
+    /** handle of a registered topic */
+    typedef TopicCache::Handle TopicHandle;
+
+    /**
+     * connect to a broker, in the background
+     *
+     * @param[in] host host name of the broker
+     * @param[in] port port of the broker
+     * @param[in] qos QoS of the published messages
+     * @param[in] id client id
+     * @param[in] username user name, nullptr for none
+     * @param[in] password password, nullptr for none
+     * @param[in] verbose print every published message
+     * @param[in] name broker label of the metrics, empty for none
+     * @param[in] version MQTT_PROTOCOL_V311, or MQTT_PROTOCOL_V5 falling back to 3.1.1 if the broker refuses it
+     * @param[in] maxInflight QoS 1/2 messages sent and not yet acknowledged, libmosquitto queues the others
+     * @throw std::runtime_error if the client can't be created
+     */
+    MqttClient(const char * host, int port, int qos, const char * id, const char * username, const char * password, bool verbose = false, const std::string & name = "", int version = MQTT_PROTOCOL_V311, unsigned int maxInflight = 20);
     virtual ~MqttClient();
 
+    MqttClient(const MqttClient &) = delete;
+    MqttClient & operator=(const MqttClient &) = delete;
+
+    /**
+     * parse an MQTT protocol version
+     *
+     * @param[in] name 3.1.1 or 5
+     * @return MQTT_PROTOCOL_V311 or MQTT_PROTOCOL_V5
+     * @throw std::invalid_argument on unknown versions
+     */
+    static int parseVersion(const std::string & name);
+
+    /**
+     * register a topic, to publish to it by handle without building strings
+     *
+     * @param[in] topic full topic (e.g. /devices/123456-energy/controls/Current Power)
+     * @return handle, the same for the same topic
+     */
+    TopicHandle addTopic(const std::string & topic);
+
+    /**
+     * set topic, and publish on change
+     *
+     * While the broker is unreachable, only the latest payload of the topic
+     * is kept and published after reconnect.
+     *
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     * @param[in] force publish even if unchanged
+     */
+    void setTopic(TopicHandle handle, std::string_view payload, bool force = false);
+
+    /**
+     * set topic to a formatted value, and publish on change
+     *
+     * While the broker is unreachable, the value is written to the spool
+     * instead, if one is set. Without a spool it is dropped, and the latest
+     * value is published after reconnect.
+     *
+     * @param[in] handle topic handle
+     * @param[in] value value
+     * @param[in] precision number of decimals
+     * @param[in] force publish even if unchanged
+     */
+    void setTopic(TopicHandle handle, double value, int precision, bool force = false);
+
     /**
      * set topic, and publish on change
      *
-     * @param topic[in] topic
+     * @param topic[in] full topic (e.g. /devices/123456-energy/controls/Current Power)
      * @param payload payload
      */
-    void setTopic(std::string topic, std::string payload);
+    void setTopic(const std::string & topic, std::string_view payload);
+
+    /**
+     * let the broker drop messages of a topic not delivered in time, MQTT 5 only
+     *
+     * The retained message expires too, so clients connecting later get no
+     * stale value.
+     *
+     * @param[in] handle topic handle
+     * @param[in] seconds message expiry interval, 0 for none
+     */
+    void setExpiry(TopicHandle handle, uint32_t seconds);
+
+    /**
+     * set QoS and retain flag of a topic, instead of the client's QoS and retained
+     *
+     * @param[in] handle topic handle
+     * @param[in] qos QoS, -1 for the QoS of the client
+     * @param[in] retain publish retained
+     */
+    void setDelivery(TopicHandle handle, int qos, bool retain);
 
     /**
-     * get topic, that was set before
+     * limit the messages passed to libmosquitto and not yet sent or acknowledged
      *
-     * @param[in] topic topic
-     * @param[in] default default value, if topic is not available
-     * @return payload
+     * Values beyond the limit are spooled, if a spool is set, or dropped;
+     * their topics are published again with the next change.
+     *
+     * @param[in] maxQueued number of messages, 0 for no limit
      */
-    std::string getTopic(std::string topic, std::string defaultValue = "") const;
+    void setMaxQueued(std::size_t maxQueued) { m_maxQueued = maxQueued; }
+
+    /**
+     * publish everything set on this client on another broker too
+     *
+     * Topics are added to the mirror as they are added here, so call it
+     * before adding topics. Give the mirror a publisher thread (see
+     * startPublisher()), then it never delays this client.
+     *
+     * @param[in] mirror client of the other broker, not owned
+     */
+    void addMirror(MqttClient * mirror);
+
+    /**
+     * publish the values set by handle from a publisher thread
+     *
+     * The values are queued by setTopic() and published after commit().
+     * Call all setTopic() and commit() from one thread afterwards.
+     *
+     * @param[in] capacity number of queued values
+     * @param[in] overflow handling of a full queue
+     * @param[in] backfillPerTick spooled values published every backfillInterval by the publisher thread
+     * @param[in] backfillInterval interval of the backfill
+     * @throw std::system_error if the thread can't be started
+     */
+    void startPublisher(std::size_t capacity, PublishQueue::Overflow overflow, std::size_t backfillPerTick, std::chrono::milliseconds backfillInterval = std::chrono::milliseconds(100));
+
+    /** wake the publisher thread for the values set so far, no-op without it */
+    void commit();
+
+    /**
+     * trace the latency of the following values until they are acknowledged
+     *
+     * Only values published by handle are traced.
+     *
+     * @param[in] trace timestamps of the telegram, nullptr to stop tracing
+     */
+    void setTrace(const TelegramTrace * trace);
+
+    /**
+     * spool values while the broker is unreachable
+     *
+     * @param[in] spool spool, nullptr to disable
+     */
+    void setSpool(Spool * spool) { m_spool = spool; }
+
+    /**
+     * publish spooled values in order on backfill topics (topic + "/backfill")
+     *
+     * The payload is {"time":<ms since epoch>,"value":<value>}. Call it from
+     * the thread calling setTopic(), or let the publisher thread call it (see
+     * startPublisher()). It does nothing while not connected.
+     *
+     * @param[in] max maximum number of values to publish
+     * @return number of values published
+     */
+    std::size_t backfill(std::size_t max);
+
+    /**
+     * seed the change detection from the retained messages on the broker
+     *
+     * Subscribes to the topics, waits until the broker has sent the
+     * retained messages, and unsubscribes again. Payloads equal to the
+     * retained ones are not published again afterwards. Mirrors are warmed
+     * up at the same time. Call it before setting any topic.
+     *
+     * @param[in] topics subscriptions (e.g. /devices/123456-energy/controls/#)
+     * @param[in] timeout maximum time to wait, also while the broker is unreachable
+     * @return number of retained messages seen by this client
+     */
+    std::size_t warmUp(const std::vector<std::string> & topics, std::chrono::milliseconds timeout);
 
 private:
-    virtual void on_connect(int rc);
-    virtual void on_message(const struct mosquitto_message * message);
+    void on_connect(int rc, const mosquitto_property * properties);
+    void on_disconnect(int rc);
+    void on_publish(int mid);
+    void on_message(const struct mosquitto_message * message);
+    void on_subscribe();
+
+    /** libmosquitto callbacks, obj is the client */
+    static void connectCallback(struct mosquitto * mosq, void * obj, int rc, int flags, const mosquitto_property * properties);
+    static void disconnectCallback(struct mosquitto * mosq, void * obj, int rc);
+    static void publishCallback(struct mosquitto * mosq, void * obj, int mid);
+    static void messageCallback(struct mosquitto * mosq, void * obj, const struct mosquitto_message * message);
+    static void subscribeCallback(struct mosquitto * mosq, void * obj, int mid, int qos_count, const int * granted_qos);
+
+    /** reconnect with MQTT 3.1.1, from a thread of its own as the loop thread is stopped */
+    void fallBack();
+
+    /** libmosquitto client */
+    struct mosquitto * m_mosq;
+
+    /** host name of the broker */
+    std::string m_host;
+
+    /** port of the broker */
+    int m_port;
+
+    /** protocol version, changed once by fallBack() */
+    std::atomic<int> m_version;
+
+    /** connected once, set by the mosquitto thread */
+    bool m_hasConnected;
+
+    /** serializes starting m_fallBack and the destructor */
+    std::mutex m_fallBackMutex;
+
+    /** set by the destructor, no fall back is started afterwards */
+    bool m_stopping;
+
+    /** restarts the connection with MQTT 3.1.1 */
+    std::thread m_fallBack;
+
+    /** state of the warm-up */
+    enum class WarmUp
+    {
+        Off, /**< not started or finished */
+        Pending, /**< waiting for the connection */
+        Subscribing, /**< waiting for the SUBACKs */
+        Receiving /**< receiving retained messages */
+    };
+
+    /** broker label of the metrics */
+    std::string m_name;
 
     /** qos */
     int m_qos;
@@ -60,14 +282,224 @@ private:
     /** verbose mode */
     bool m_verbose;
 
-    /** base topic */
-    std::string m_baseTopic;
+    /**
+     * publish a payload on change
+     *
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     * @param[in] force publish even if unchanged
+     * @param[in] spool a value, spooled or dropped while not connected, else a payload kept for reconnect
+     * @param[in] trace telegram of the payload, nullptr if not traced
+     */
+    void publishTopic(TopicHandle handle, std::string_view payload, bool force, bool spool, const TelegramTrace * trace);
+
+    /**
+     * publish with MQTT 5 properties, the topic alias and the message expiry
+     *
+     * @param[out] mid message id
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     * @param[in] qos QoS
+     * @param[in] retain publish retained
+     * @return libmosquitto error code
+     */
+    int publishV5(int * mid, TopicHandle handle, std::string_view payload, int qos, bool retain);
+
+    /**
+     * count a message passed to libmosquitto as in flight until on_publish()
+     *
+     * A message acknowledged before it is counted stays counted until its
+     * message id is used again.
+     *
+     * @param[in] mid message id
+     * @param[in] qos QoS of the message
+     */
+    void trackInflight(int mid, int qos);
+
+    /**
+     * publish a value
+     *
+     * @param[in] handle topic handle
+     * @param[in] value value
+     * @param[in] precision number of decimals
+     * @param[in] force publish even if unchanged
+     * @param[in] trace telegram of the value, nullptr if not traced
+     */
+    void publishValue(TopicHandle handle, double value, int precision, bool force, const TelegramTrace * trace);
+
+    /**
+     * queue an item for the publisher thread
+     *
+     * @param[in] handle topic handle
+     * @param[in] force publish even if unchanged
+     */
+    void queueItem(TopicHandle handle, bool force);
+
+    /**
+     * write a payload to the spool, and publish it again after reconnect
+     *
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     */
+    void spoolValue(TopicHandle handle, std::string_view payload);
+
+    /**
+     * keep the latest payload of a topic while not connected
+     *
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     */
+    void keepOffline(TopicHandle handle, std::string_view payload);
+
+    /**
+     * publish the payloads kept while not connected
+     */
+    void publishOffline();
+
+    /**
+     * start the warm-up, subscribe now if connected or else on connect
+     *
+     * @param[in] topics subscriptions
+     */
+    void beginWarmUp(const std::vector<std::string> & topics);
+
+    /** subscribe to the warm-up topics, with m_warmUpMutex held */
+    void subscribeWarmUp();
+
+    /**
+     * wait until no retained message arrived for a while, and unsubscribe
+     *
+     * @param[in] deadline end of the warm-up, also without retained messages
+     * @return number of retained messages seen
+     */
+    std::size_t endWarmUp(std::chrono::steady_clock::time_point deadline);
+
+    /** registered topics, with hash and version of the last payload */
+    TopicCache m_topics;
+
+    /** connected to the broker, set by the mosquitto thread */
+    std::atomic<bool> m_connected;
+
+    /** incremented on every connect and disconnect, topic aliases are valid for one connection */
+    std::atomic<uint32_t> m_session;
+
+    /** topic aliases accepted by the broker, 0 for none */
+    std::atomic<uint16_t> m_aliasMaximum;
+
+    /** session of m_aliases, only used by the publishing thread */
+    uint32_t m_aliasSession;
+
+    /** next free topic alias, only used by the publishing thread */
+    uint16_t m_nextAlias;
+
+    /** topic alias per handle, 0 for none, only used by the publishing thread */
+    std::vector<uint16_t> m_aliases;
+
+    /** message expiry interval in seconds per handle, 0 for none */
+    std::vector<uint32_t> m_expiry;
+
+    /** QoS per handle, -1 for m_qos */
+    std::vector<int8_t> m_topicQos;
+
+    /** retain flag per handle */
+    std::vector<uint8_t> m_topicRetain;
+
+    /** QoS 1/2 messages in flight */
+    unsigned int m_maxInflight;
+
+    /** messages passed to libmosquitto, 0 for no limit */
+    std::size_t m_maxQueued;
+
+    /** offline spool, nullptr if disabled */
+    Spool * m_spool;
+
+    /** latest payload per handle while not connected */
+    std::vector<std::string> m_offlinePayloads;
+
+    /** handles with a payload in m_offlinePayloads */
+    std::vector<TopicHandle> m_offlineHandles;
+
+    /** set on connect, the kept payloads are published with the next publish */
+    std::atomic<bool> m_reconnected;
+
+    /** publishes attempted */
+    Counter & m_publishes;
+
+    /** publishes failed */
+    Counter & m_publishFailures;
+
+    /** publishes suppressed because the payload was unchanged */
+    Counter & m_publishSuppressed;
+
+    /** messages passed to libmosquitto and not yet sent or acknowledged */
+    Gauge & m_queueDepth;
+
+    /** QoS 1/2 publishes queued by libmosquitto as maxInflight messages were unacknowledged */
+    Counter & m_inflightExhausted;
+
+    /** QoS 1/2 messages passed to libmosquitto and not yet acknowledged */
+    std::atomic<int64_t> m_inflight;
+
+    /** message ids counted in m_inflight, one bit per id */
+    std::array<std::atomic<uint64_t>, 1024> m_inflightMids;
+
+    /** publishes dropped or spooled as maxQueued messages were queued */
+    Counter & m_queueFull;
+
+    /** duration of publish() */
+    Histogram & m_publishDuration;
+
+    /** telegram of the values currently published, nullptr if not traced */
+    const TelegramTrace * m_trace;
+
+    /** queue to the publisher thread, nullptr to publish from the calling thread */
+    std::unique_ptr<PublishQueue> m_queue;
+
+    /** item filled by setTopic() before it is queued */
+    PublishItem m_item;
+
+    /** clients of other brokers getting the same values */
+    std::vector<MqttClient *> m_mirrors;
+
+    /** handle of the mirror per mirror and handle */
+    std::vector<std::vector<TopicHandle>> m_mirrorHandles;
+
+    /** serializes the warm-up between the caller and the mosquitto thread */
+    std::mutex m_warmUpMutex;
+
+    /** signaled on SUBACK */
+    std::condition_variable m_warmUpChanged;
+
+    /** state of the warm-up */
+    WarmUp m_warmUp;
+
+    /** subscriptions of the warm-up */
+    std::vector<std::string> m_warmUpTopics;
+
+    /** SUBACKs outstanding */
+    std::size_t m_warmUpAcks;
+
+    /** retained messages seen */
+    std::size_t m_warmUpRetained;
+
+    /** arrival of the last retained message, or of the last SUBACK */
+    std::chrono::steady_clock::time_point m_warmUpLast;
+
+    /** traced message waiting for on_publish(), written by the caller, read by the mosquitto thread */
+    struct PendingAck
+    {
+        /** message id, 0 if free */
+        std::atomic<int> mid;
+
+        /** first byte of the telegram read, ns since the steady clock epoch */
+        std::atomic<int64_t> firstByte;
 
-    /** map of payload per topic, to detect changes */
-    std::map<std::string, std::string> m_topicPayloads;
+        /** publish() returned, ns since the steady clock epoch */
+        std::atomic<int64_t> published;
+    };
 
-    /** mutex to access m_topicPayloads */
-    mutable std::mutex m_topicPayloadsMutex;
+    /** traced messages, indexed by message id */
+    std::array<PendingAck, 256> m_pendingAcks;
 };
 
 
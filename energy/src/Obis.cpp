@@ -0,0 +1,69 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Obis.h"
+
+/* C++ includes */
+#include <cstdio>
+
+bool parseObis(const std::string & str, ObisCode & obis)
+{
+    static const char separators[] = "-:..*";
+    unsigned int groups[6] = { 0, 0, 0, 0, 0, 255 };
+    std::size_t pos = 0;
+
+    for (int i = 0; i < 6; i++) {
+        /* separator before group */
+        if (i > 0) {
+            if (pos == str.length() && i == 5) {
+                break;
+            }
+            if (pos >= str.length() || str[pos] != separators[i - 1]) {
+                return false;
+            }
+            pos++;
+        }
+
+        /* decimal value 0..255 */
+        std::size_t start = pos;
+        unsigned int value = 0;
+        while (pos < str.length() && str[pos] >= '0' && str[pos] <= '9' && pos - start < 3) {
+            value = value * 10 + (str[pos] - '0');
+            pos++;
+        }
+        if (pos == start || value > 255) {
+            return false;
+        }
+        groups[i] = value;
+    }
+    if (pos != str.length()) {
+        return false;
+    }
+
+    obis = obisCode(groups[0], groups[1], groups[2], groups[3], groups[4], groups[5]);
+    return true;
+}
+
+std::string obisToString(ObisCode obis)
+{
+    char str[32];
+    snprintf(str, sizeof(str), "%u-%u:%u.%u.%u*%u",
+             static_cast<unsigned int>((obis >> 40) & 0xff),
+             static_cast<unsigned int>((obis >> 32) & 0xff),
+             static_cast<unsigned int>((obis >> 24) & 0xff),
+             static_cast<unsigned int>((obis >> 16) & 0xff),
+             static_cast<unsigned int>((obis >> 8) & 0xff),
+             static_cast<unsigned int>(obis & 0xff));
+    return str;
+}
@@ -0,0 +1,75 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstdint>
+#include <string>
+
+/**
+ * OBIS code (A-B:C.D.E*F), packed big endian into the lower 48 bits.
+ *
+ * This allows to switch on the raw 6 byte obj_name of a list entry
+ * without building a string first.
+ */
+typedef uint64_t ObisCode;
+
+/** pack the six value groups of an OBIS code */
+constexpr ObisCode obisCode(uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e, uint8_t f)
+{
+    return (static_cast<ObisCode>(a) << 40) |
+           (static_cast<ObisCode>(b) << 32) |
+           (static_cast<ObisCode>(c) << 24) |
+           (static_cast<ObisCode>(d) << 16) |
+           (static_cast<ObisCode>(e) << 8) |
+           static_cast<ObisCode>(f);
+}
+
+/**
+ * pack the raw obj_name of a list entry
+ *
+ * @param[in] str obj_name octets
+ * @param[in] len number of octets, must be 6 for a valid OBIS code
+ * @return packed OBIS code, or 0 if len is invalid
+ */
+inline ObisCode obisCode(const unsigned char * str, int len)
+{
+    return (len == 6) ? obisCode(str[0], str[1], str[2], str[3], str[4], str[5]) : 0;
+}
+
+/** 1-0:16.7.0*255 - current power */
+constexpr ObisCode OBIS_CURRENT_POWER = obisCode(1, 0, 16, 7, 0, 255);
+
+/** 1-0:1.8.0*255 - total energy */
+constexpr ObisCode OBIS_TOTAL_ENERGY = obisCode(1, 0, 1, 8, 0, 255);
+
+/**
+ * parse an OBIS code string
+ *
+ * Accepts "A-B:C.D.E*F" and "A-B:C.D.E", where F defaults to 255.
+ *
+ * @param[in] str OBIS code string (e.g. 1-0:1.8.0*255)
+ * @param[out] obis packed OBIS code
+ * @return true on success
+ */
+bool parseObis(const std::string & str, ObisCode & obis);
+
+/**
+ * format an OBIS code as "A-B:C.D.E*F"
+ *
+ * @param[in] obis packed OBIS code
+ * @return OBIS code string
+ */
+std::string obisToString(ObisCode obis);
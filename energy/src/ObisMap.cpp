@@ -0,0 +1,181 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "ObisMap.h"
+
+/* C++ includes */
+#include <stdexcept>
+
+/** number of multipliers tried per table size */
+static const int maxSeeds = 64;
+
+/** splitmix64, used to derive hash multipliers */
+static uint64_t splitmix64(uint64_t & state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+ObisMap::ObisMap() :
+    m_registers(),
+    m_slots(),
+    m_multiplier(0),
+    m_shift(0)
+{
+    build();
+}
+
+ObisMap ObisMap::defaults()
+{
+    ObisMap map;
+    map.add({OBIS_CURRENT_POWER, "Current Power", 1, " W", 1, 1});
+    map.add({OBIS_TOTAL_ENERGY, "Total Energy", 1000, " kWh", 1, 2});
+    return map;
+}
+
+void ObisMap::load(const YAML::Node & node)
+{
+    if (!node.IsSequence()) {
+        throw std::invalid_argument("registers: must be a list");
+    }
+
+    m_registers.clear();
+    build();
+    for (const YAML::Node & entry : node) {
+        if (!entry["obis"] || !entry["topic"]) {
+            throw std::invalid_argument("registers: obis and topic are required");
+        }
+
+        ObisRegister reg;
+        std::string obis = entry["obis"].as<std::string>();
+        if (!parseObis(obis, reg.obis)) {
+            throw std::invalid_argument("registers: invalid obis " + obis);
+        }
+        reg.topic = entry["topic"].as<std::string>();
+        reg.scale = entry["scale"] ? entry["scale"].as<double>() : 1;
+        reg.unit = entry["unit"] ? entry["unit"].as<std::string>() : "";
+        reg.precision = entry["precision"] ? entry["precision"].as<int>() : 1;
+        reg.order = entry["order"] ? entry["order"].as<int>() : static_cast<int>(m_registers.size() + 1);
+        if (entry["deadband"]) {
+            std::string deadband = entry["deadband"].as<std::string>();
+            if (!deadband.empty() && deadband.back() == '%') {
+                deadband.pop_back();
+                reg.policy.relativeDeadband = std::stod(deadband) / 100;
+            } else {
+                reg.policy.deadband = entry["deadband"].as<double>();
+            }
+        }
+        reg.policy.minInterval = entry["min_interval"] ? entry["min_interval"].as<double>() : 0;
+        reg.policy.maxInterval = entry["max_interval"] ? entry["max_interval"].as<double>() : 0;
+        if (entry["aggregate"]) {
+            const YAML::Node & aggregate = entry["aggregate"];
+            if (!aggregate["windows"] || !aggregate["windows"].IsSequence()) {
+                throw std::invalid_argument("registers: aggregate of " + obis + " needs a windows list");
+            }
+            for (const YAML::Node & window : aggregate["windows"]) {
+                std::chrono::seconds seconds;
+                if (!Aggregator::parseWindow(window.as<std::string>(), seconds)) {
+                    throw std::invalid_argument("registers: invalid aggregate window " + window.as<std::string>() + " of " + obis);
+                }
+                reg.aggregate.windows.push_back(seconds);
+            }
+            if (aggregate["values"]) {
+                for (const YAML::Node & value : aggregate["values"]) {
+                    AggregateValue v;
+                    if (!Aggregator::parseValue(value.as<std::string>(), v)) {
+                        throw std::invalid_argument("registers: invalid aggregate value " + value.as<std::string>() + " of " + obis);
+                    }
+                    reg.aggregate.values.push_back(v);
+                }
+            } else {
+                reg.aggregate.values = { AggregateValue::Mean, AggregateValue::Min, AggregateValue::Max };
+            }
+        }
+        if (entry["expiry"]) {
+            reg.expiry = entry["expiry"].as<uint32_t>();
+        }
+        reg.qos = entry["qos"] ? entry["qos"].as<int>() : -1;
+        reg.retain = entry["retain"] ? entry["retain"].as<bool>() : true;
+        if (reg.scale == 0) {
+            throw std::invalid_argument("registers: scale of " + obis + " must not be 0");
+        }
+        if (reg.qos < -1 || reg.qos > 2) {
+            throw std::invalid_argument("registers: qos of " + obis + " must be 0..2");
+        }
+        if (reg.precision < 0 || reg.precision > 9) {
+            throw std::invalid_argument("registers: precision of " + obis + " must be 0..9");
+        }
+        if (reg.policy.deadband < 0 || reg.policy.relativeDeadband < 0 || reg.policy.minInterval < 0 || reg.policy.maxInterval < 0) {
+            throw std::invalid_argument("registers: deadband and intervals of " + obis + " must not be negative");
+        }
+        if (reg.policy.maxInterval > 0 && reg.policy.maxInterval < reg.policy.minInterval) {
+            throw std::invalid_argument("registers: max_interval of " + obis + " must not be below min_interval");
+        }
+        add(reg);
+    }
+}
+
+void ObisMap::add(const ObisRegister & reg)
+{
+    if (indexOf(reg.obis) >= 0) {
+        throw std::invalid_argument("registers: duplicate obis " + obisToString(reg.obis));
+    }
+    m_registers.push_back(reg);
+    build();
+}
+
+void ObisMap::build()
+{
+    /* at least twice the number of registers, to find a seed quickly */
+    unsigned int bits = 3;
+    while ((1U << bits) < 2 * m_registers.size()) {
+        bits++;
+    }
+
+    uint64_t state = 0;
+    for (;;) {
+        for (int seed = 0; seed < maxSeeds; seed++) {
+            std::vector<Slot> slots(1U << bits, Slot{0, -1});
+            uint64_t multiplier = splitmix64(state) | 1;
+            unsigned int shift = 64 - bits;
+
+            bool collision = false;
+            for (std::size_t i = 0; i < m_registers.size(); i++) {
+                Slot & slot = slots[(m_registers[i].obis * multiplier) >> shift];
+                if (slot.index >= 0) {
+                    collision = true;
+                    break;
+                }
+                slot.obis = m_registers[i].obis;
+                slot.index = static_cast<int>(i);
+            }
+
+            /* empty slots must never match a valid lookup */
+            if (!collision) {
+                for (Slot & slot : slots) {
+                    if (slot.index < 0) {
+                        slot.obis = ~static_cast<ObisCode>(0);
+                    }
+                }
+                m_slots.swap(slots);
+                m_multiplier = multiplier;
+                m_shift = shift;
+                return;
+            }
+        }
+        bits++;
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+/* project internal includes */
+#include "Aggregator.h"
+#include "Obis.h"
+#include "PublishPolicy.h"
+
+/** OBIS register to HomA control mapping */
+struct ObisRegister
+{
+    /** OBIS code */
+    ObisCode obis;
+
+    /** HomA control name (e.g. Current Power) */
+    std::string topic;
+
+    /** divisor applied to the scaled meter value (e.g. 1000 for Wh to kWh) */
+    double scale;
+
+    /** HomA unit (e.g. " kWh") */
+    std::string unit;
+
+    /** number of decimals */
+    int precision;
+
+    /** HomA order */
+    int order;
+
+    /** when to publish, publish every change by default */
+    PublishPolicy policy{};
+
+    /** aggregation windows, none by default */
+    AggregateConfig aggregate{};
+
+    /** MQTT 5 message expiry interval in seconds, 0 for none */
+    uint32_t expiry = 0;
+
+    /** QoS, -1 for the QoS of the broker */
+    int qos = -1;
+
+    /** publish retained */
+    bool retain = true;
+};
+
+/**
+ * Map of OBIS codes to registers.
+ *
+ * The registers are compiled into a collision free hash table keyed by the
+ * packed OBIS code, so a lookup is one multiplication and one compare,
+ * independent of the number of mapped registers.
+ */
+class ObisMap
+{
+public:
+    ObisMap();
+
+    /**
+     * registers published by default
+     *
+     * @return map containing Current Power (1-0:16.7.0*255) and Total Energy (1-0:1.8.0*255)
+     */
+    static ObisMap defaults();
+
+    /**
+     * load registers from a YAML sequence
+     *
+     * Each entry is a map with keys obis, topic, scale, unit, precision, order,
+     * deadband (absolute, or relative with a % suffix), min_interval,
+     * max_interval (seconds), aggregate (map with windows and values),
+     * expiry (seconds), qos and retain.
+     * Only obis and topic are mandatory.
+     *
+     * @param[in] node YAML sequence
+     * @throw std::invalid_argument on invalid entries
+     */
+    void load(const YAML::Node & node);
+
+    /**
+     * add a register
+     *
+     * @param[in] reg register
+     * @throw std::invalid_argument if the OBIS code is already mapped
+     */
+    void add(const ObisRegister & reg);
+
+    /**
+     * find the register of an OBIS code
+     *
+     * @param[in] obis packed OBIS code
+     * @return index of register, or -1 if not mapped
+     */
+    int indexOf(ObisCode obis) const
+    {
+        const Slot & slot = m_slots[(obis * m_multiplier) >> m_shift];
+        return (slot.obis == obis) ? slot.index : -1;
+    }
+
+    /** number of registers */
+    std::size_t size() const { return m_registers.size(); }
+
+    /** register by index */
+    const ObisRegister & operator[](std::size_t index) const { return m_registers[index]; }
+
+    std::vector<ObisRegister>::const_iterator begin() const { return m_registers.begin(); }
+    std::vector<ObisRegister>::const_iterator end() const { return m_registers.end(); }
+
+private:
+    /** hash table slot */
+    struct Slot
+    {
+        /** OBIS code */
+        ObisCode obis;
+
+        /** index into m_registers, -1 if empty */
+        int index;
+    };
+
+    /** rebuild the hash table */
+    void build();
+
+    /** registers in configuration order */
+    std::vector<ObisRegister> m_registers;
+
+    /** hash table, size is a power of two */
+    std::vector<Slot> m_slots;
+
+    /** hash multiplier */
+    uint64_t m_multiplier;
+
+    /** hash shift (64 - log2 of table size) */
+    unsigned int m_shift;
+};
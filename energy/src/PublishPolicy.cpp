@@ -0,0 +1,61 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "PublishPolicy.h"
+
+/* C++ includes */
+#include <cmath>
+
+PublishFilter::PublishFilter(const PublishPolicy & policy) :
+    m_policy(policy),
+    m_published(false),
+    m_lastValue(0),
+    m_lastTime()
+{
+}
+
+PublishFilter::Decision PublishFilter::check(double value)
+{
+    Decision decision = Decision::Publish;
+
+    /* the clock is only read for policies that need it */
+    bool timed = (m_policy.minInterval > 0) || (m_policy.maxInterval > 0);
+    Clock::time_point now;
+    if (timed) {
+        now = Clock::now();
+    }
+
+    if (m_published) {
+        double elapsed = timed ? std::chrono::duration<double>(now - m_lastTime).count() : 0;
+        double delta = std::fabs(value - m_lastValue);
+
+        if (m_policy.maxInterval > 0 && elapsed >= m_policy.maxInterval) {
+            decision = Decision::Force;
+        } else
+        if (m_policy.minInterval > 0 && elapsed < m_policy.minInterval) {
+            return Decision::Drop;
+        } else
+        if ((m_policy.deadband > 0 && delta <= m_policy.deadband) ||
+                (m_policy.relativeDeadband > 0 && delta <= m_policy.relativeDeadband * std::fabs(m_lastValue))) {
+            return Decision::Drop;
+        }
+    }
+
+    m_published = true;
+    m_lastValue = value;
+    if (timed) {
+        m_lastTime = now;
+    }
+    return decision;
+}
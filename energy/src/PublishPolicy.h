@@ -0,0 +1,82 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <chrono>
+
+/** when to publish a register value */
+struct PublishPolicy
+{
+    /** absolute deadband in published units, 0 to disable */
+    double deadband;
+
+    /** deadband relative to the last published value (e.g. 0.02 for 2%), 0 to disable */
+    double relativeDeadband;
+
+    /** minimum seconds between two publishes, 0 to disable */
+    double minInterval;
+
+    /** maximum seconds between two publishes, unchanged values are published again, 0 to disable */
+    double maxInterval;
+};
+
+/**
+ * Applies a PublishPolicy to the values of one register.
+ *
+ * Values are compared to the last published value, not to the previous
+ * one, so a slow drift is published once it leaves the deadband.
+ */
+class PublishFilter
+{
+public:
+    /** result of check() */
+    enum class Decision
+    {
+        /** don't publish */
+        Drop,
+
+        /** publish, if the formatted value has changed */
+        Publish,
+
+        /** publish, even if the formatted value is unchanged (heartbeat) */
+        Force
+    };
+
+    explicit PublishFilter(const PublishPolicy & policy);
+
+    /**
+     * decide if a value is published, and remember it if so
+     *
+     * @param[in] value value in published units, before formatting
+     * @return decision
+     */
+    Decision check(double value);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /** policy */
+    PublishPolicy m_policy;
+
+    /** a value was published */
+    bool m_published;
+
+    /** last published value */
+    double m_lastValue;
+
+    /** time of the last publish, only maintained for timed policies */
+    Clock::time_point m_lastTime;
+};
@@ -0,0 +1,182 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "PublishQueue.h"
+
+/* C includes */
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+PublishQueue::PublishQueue(const std::string & name, std::size_t capacity, std::size_t handles, Overflow overflow, Handler handler, EventLoop::Callback idle, std::chrono::milliseconds idleInterval) :
+    m_queue(capacity),
+    m_overflow(overflow),
+    m_handler(handler),
+    m_pending(),
+    m_pendingOrder(),
+    m_pendingFirst(0),
+    m_item(),
+    m_dropped(metrics().counter("publish_queue_dropped", "items dropped because the publish queue was full", name, "broker")),
+    m_coalesced(metrics().counter("publish_queue_coalesced", "items replaced by a newer one of the same topic while the publish queue was full", name, "broker")),
+    m_batches(metrics().counter("publish_queue_batches", "batches drained by the publisher thread", name, "broker")),
+    m_loop(),
+    m_eventFd(-1),
+    m_sleeping(true),
+    m_thread()
+{
+    /* the overflow table is allocated once, it is filled while the publisher lags */
+    if (m_overflow == Overflow::Coalesce) {
+        m_pending.resize(handles);
+        m_pendingOrder.reserve(handles);
+    }
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    }
+    m_loop.addFd(m_eventFd, EPOLLIN, [this](uint32_t) {
+        uint64_t count;
+        if (read(m_eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            std::cerr << "PublishQueue: read failed" << std::endl;
+        }
+        drain();
+    });
+    if (idle) {
+        m_loop.addTimer(idleInterval, idle);
+    }
+
+    try {
+        m_thread = std::thread([this]() { m_loop.run(); });
+    } catch (...) {
+        close(m_eventFd);
+        throw;
+    }
+}
+
+PublishQueue::~PublishQueue()
+{
+    m_loop.stop();
+    m_thread.join();
+
+    /* hand out what is left on this thread */
+    while (depth() > 0) {
+        flushPending();
+        drain();
+    }
+    close(m_eventFd);
+}
+
+void PublishQueue::push(PublishItem & item)
+{
+    /* items already waiting go first, to keep the order per topic */
+    if (m_pendingFirst < m_pendingOrder.size()) {
+        flushPending();
+    }
+    if (m_pendingFirst == m_pendingOrder.size() && m_queue.push(item)) {
+        return;
+    }
+
+    if (m_overflow == Overflow::DropOldest) {
+        if (m_queue.discard()) {
+            m_dropped.add();
+        }
+        if (!m_queue.push(item)) {
+            /* the publisher is still reading the freed slot */
+            m_dropped.add();
+        }
+        return;
+    }
+
+    /* keep the latest item per topic, a forced one stays forced */
+    PublishItem & pending = m_pending[item.handle];
+    if (pending.pending) {
+        m_coalesced.add();
+        item.force = item.force || pending.force;
+    } else {
+        m_pendingOrder.push_back(item.handle);
+    }
+    std::swap(pending, item);
+    pending.pending = true;
+}
+
+void PublishQueue::commit()
+{
+    if (m_pendingFirst < m_pendingOrder.size()) {
+        flushPending();
+    }
+
+    /* a busy publisher finds the items without a syscall */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_sleeping.exchange(false)) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(m_eventFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        std::cerr << "PublishQueue::commit: write failed" << std::endl;
+    }
+}
+
+PublishQueue::Overflow PublishQueue::parseOverflow(const std::string & text)
+{
+    if (text == "drop_oldest") {
+        return Overflow::DropOldest;
+    }
+    if (text == "coalesce") {
+        return Overflow::Coalesce;
+    }
+    throw std::invalid_argument("publish_overflow: " + text + " is not drop_oldest or coalesce");
+}
+
+void PublishQueue::flushPending()
+{
+    while (m_pendingFirst < m_pendingOrder.size()) {
+        TopicCache::Handle handle = m_pendingOrder[m_pendingFirst];
+        if (!m_queue.push(m_pending[handle])) {
+            return;
+        }
+        m_pending[handle].pending = false;
+        m_pendingFirst++;
+    }
+    m_pendingOrder.clear();
+    m_pendingFirst = 0;
+}
+
+void PublishQueue::drain()
+{
+    std::size_t count = 0;
+    for (;;) {
+        while (m_queue.pop(m_item)) {
+            m_handler(m_item);
+            count++;
+        }
+
+        /* announce the sleep, then look again for items committed meanwhile */
+        m_sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_queue.size() == 0 || !m_sleeping.exchange(false)) {
+            break;
+        }
+    }
+    if (count > 0) {
+        m_batches.add();
+    }
+}
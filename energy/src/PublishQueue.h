@@ -0,0 +1,181 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* project internal includes */
+#include "EventLoop.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "SpscQueue.h"
+#include "TopicCache.h"
+
+/** value or payload to publish on a topic */
+struct PublishItem
+{
+    /** topic handle */
+    TopicCache::Handle handle;
+
+    /** value is set and formatted by the publisher, else payload */
+    bool isValue;
+
+    /** value */
+    double value;
+
+    /** number of decimals of value */
+    int precision;
+
+    /** payload, if not isValue */
+    std::string payload;
+
+    /** publish even if unchanged */
+    bool force;
+
+    /** trace is set */
+    bool traced;
+
+    /** telegram of the value */
+    TelegramTrace trace;
+
+    /** waiting in the overflow table, only used there */
+    bool pending;
+};
+
+/**
+ * Passes items from the reading thread to a publisher thread.
+ *
+ * The reading thread pushes items into a bounded lock-free queue and
+ * wakes the publisher by commit(), e.g. once per telegram. The publisher
+ * thread drains all queued items in one batch. A slow publisher never
+ * blocks the reading thread; if the queue is full, the oldest item is
+ * dropped, or items wait in an overflow table holding the latest item
+ * per topic until there is room again.
+ */
+class PublishQueue
+{
+public:
+    /** handling of a full queue */
+    enum class Overflow
+    {
+        /** drop the oldest queued item */
+        DropOldest,
+
+        /** keep the latest item per topic until there is room */
+        Coalesce
+    };
+
+    /** called on the publisher thread per item */
+    typedef std::function<void(const PublishItem & item)> Handler;
+
+    /**
+     * start the publisher thread
+     *
+     * @param[in] name broker label of the metrics, empty for none
+     * @param[in] capacity number of queued items, rounded up to a power of two
+     * @param[in] handles number of topic handles, for the overflow table
+     * @param[in] overflow handling of a full queue
+     * @param[in] handler called on the publisher thread per item
+     * @param[in] idle called on the publisher thread every idleInterval, may be nullptr
+     * @param[in] idleInterval interval of idle
+     * @throw std::system_error if the eventfd or the thread can't be created
+     */
+    PublishQueue(const std::string & name, std::size_t capacity, std::size_t handles, Overflow overflow, Handler handler, EventLoop::Callback idle, std::chrono::milliseconds idleInterval);
+
+    /** stop the publisher thread, queued items are handled before */
+    virtual ~PublishQueue();
+
+    PublishQueue(const PublishQueue &) = delete;
+    PublishQueue & operator=(const PublishQueue &) = delete;
+
+    /**
+     * queue an item (reading thread)
+     *
+     * @param[in,out] item item, gets the contents of a free slot
+     */
+    void push(PublishItem & item);
+
+    /** wake the publisher for the pushed items (reading thread) */
+    void commit();
+
+    /** number of items queued or waiting in the overflow table */
+    std::size_t depth() const { return m_queue.size() + m_pendingOrder.size() - m_pendingFirst; }
+
+    /**
+     * parse an overflow name
+     *
+     * @param[in] text drop_oldest or coalesce
+     * @return overflow
+     * @throw std::invalid_argument if text is unknown
+     */
+    static Overflow parseOverflow(const std::string & text);
+
+private:
+    /** move items from the overflow table to the queue, as long as there is room */
+    void flushPending();
+
+    /** handle all queued items (publisher thread) */
+    void drain();
+
+    /** queue */
+    SpscQueue<PublishItem> m_queue;
+
+    /** handling of a full queue */
+    Overflow m_overflow;
+
+    /** called per item */
+    Handler m_handler;
+
+    /** latest item per handle that did not fit into the queue */
+    std::vector<PublishItem> m_pending;
+
+    /** handles in m_pending, in the order they overflowed */
+    std::vector<TopicCache::Handle> m_pendingOrder;
+
+    /** first entry of m_pendingOrder not yet queued */
+    std::size_t m_pendingFirst;
+
+    /** item the publisher thread pops into */
+    PublishItem m_item;
+
+    /** items dropped */
+    Counter & m_dropped;
+
+    /** items replaced in the overflow table by a newer one of the same topic */
+    Counter & m_coalesced;
+
+    /** batches drained */
+    Counter & m_batches;
+
+    /** publisher thread loop */
+    EventLoop m_loop;
+
+    /** eventfd to wake the publisher */
+    int m_eventFd;
+
+    /** the publisher waits for the eventfd, commit() has to wake it */
+    std::atomic<bool> m_sleeping;
+
+    /** publisher thread */
+    std::thread m_thread;
+};
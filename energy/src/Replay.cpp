@@ -0,0 +1,160 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Replay.h"
+
+/* C includes */
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+
+/** maximum number of records fed per timer expiration, to keep the loop responsive */
+static const int maxRecordsPerWakeup = 64;
+
+Replay::Replay(EventLoop & loop, SML & sml, const std::string & file, double speed) :
+    m_loop(loop),
+    m_sml(sml),
+    m_reader(file),
+    m_speed(speed),
+    m_timerFd(-1),
+    m_done(),
+    m_record(),
+    m_pending(false),
+    m_start(),
+    m_end(),
+    m_bytes(0),
+    m_latencies()
+{
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "timerfd_create");
+    }
+    m_latencies.reserve(m_reader.records());
+}
+
+Replay::~Replay()
+{
+    if (m_timerFd >= 0) {
+        m_loop.removeFd(m_timerFd);
+        close(m_timerFd);
+    }
+}
+
+void Replay::start(EventLoop::Callback done)
+{
+    m_done = done;
+    m_reader.rewind();
+    m_pending = m_reader.next(m_record);
+    m_bytes = 0;
+    m_latencies.clear();
+
+    m_loop.addFd(m_timerFd, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        if (read(m_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            onTimer();
+        }
+    });
+
+    m_start = std::chrono::steady_clock::now();
+    arm(m_start);
+}
+
+void Replay::onTimer()
+{
+    for (int i = 0; m_pending && i < maxRecordsPerWakeup; i++) {
+        std::chrono::steady_clock::time_point due = m_start;
+        if (m_speed > 0) {
+            due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_record.time / m_speed);
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (due > now) {
+            arm(due);
+            return;
+        }
+
+        /* as fast as possible: latency is the processing time only */
+        if (m_speed <= 0) {
+            due = now;
+        }
+
+        uint64_t frames = m_sml.framesReceived();
+        m_sml.feed(m_record.data, m_record.len);
+        m_bytes += m_record.len;
+        std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - due;
+        for (; frames < m_sml.framesReceived(); frames++) {
+            m_latencies.push_back(latency);
+        }
+        m_pending = m_reader.next(m_record);
+    }
+
+    if (m_pending) {
+        /* more records are due, continue after other events */
+        arm(m_start);
+        return;
+    }
+
+    m_end = std::chrono::steady_clock::now();
+    m_loop.removeFd(m_timerFd);
+    if (m_done) {
+        m_done();
+    }
+}
+
+void Replay::arm(std::chrono::steady_clock::time_point due)
+{
+    /* steady_clock is CLOCK_MONOTONIC, a time in the past expires at once */
+    std::chrono::nanoseconds time = due.time_since_epoch();
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(time).count();
+    spec.it_value.tv_nsec = (time % std::chrono::seconds(1)).count();
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        std::cerr << "Replay::arm: timerfd_settime failed" << std::endl;
+    }
+}
+
+void Replay::printStats(std::ostream & out) const
+{
+    double seconds = std::chrono::duration<double>(m_end - m_start).count();
+    out << "replay: " << m_reader.records() << " records, " << m_bytes << " bytes, "
+        << m_sml.framesReceived() << " telegrams in " << seconds << " s" << std::endl;
+    if (seconds > 0) {
+        out << "replay: " << m_sml.framesReceived() / seconds << " telegrams/s, "
+            << m_bytes / seconds << " bytes/s" << std::endl;
+    }
+    out << "replay: " << m_sml.framesDropped() << " dropped, "
+        << m_sml.crcErrors() << " CRC errors, "
+        << m_sml.parseErrors() << " parse errors" << std::endl;
+
+    if (m_latencies.empty()) {
+        return;
+    }
+    std::vector<std::chrono::nanoseconds> latencies(m_latencies);
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return std::chrono::duration<double, std::micro>(latencies[static_cast<size_t>(p * (latencies.size() - 1))]).count();
+    };
+    out << "replay: latency us p50 " << percentile(0.5)
+        << ", p99 " << percentile(0.99)
+        << ", max " << percentile(1.0) << std::endl;
+}
@@ -0,0 +1,111 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* project internal includes */
+#include "Capture.h"
+#include "EventLoop.h"
+#include "SML.h"
+
+/**
+ * Replay a capture file through a meter, instead of reading its device.
+ *
+ * The records are fed at their recorded time divided by speed, driven by
+ * a timerfd in the event loop. With speed 0 they are fed as fast as
+ * possible. Latency is measured per telegram, from the time its last
+ * record was due until it was published.
+ */
+class Replay
+{
+public:
+    /**
+     * @param[in] loop event loop
+     * @param[in] sml meter without device
+     * @param[in] file capture file or raw stream
+     * @param[in] speed 1 for real time, N for N times faster, 0 as fast as possible
+     * @throw std::runtime_error if the file can't be read
+     * @throw std::system_error if the timer can't be created
+     */
+    Replay(EventLoop & loop, SML & sml, const std::string & file, double speed);
+    virtual ~Replay();
+
+    Replay(const Replay &) = delete;
+    Replay & operator=(const Replay &) = delete;
+
+    /**
+     * start replaying
+     *
+     * @param[in] done called after the last record
+     */
+    void start(EventLoop::Callback done);
+
+    /** print throughput and latency */
+    void printStats(std::ostream & out) const;
+
+private:
+    /** feed all due records, then arm the timer for the next one */
+    void onTimer();
+
+    /**
+     * arm the timer
+     *
+     * @param[in] due absolute time
+     */
+    void arm(std::chrono::steady_clock::time_point due);
+
+    /** event loop */
+    EventLoop & m_loop;
+
+    /** meter */
+    SML & m_sml;
+
+    /** capture */
+    CaptureReader m_reader;
+
+    /** replay speed */
+    double m_speed;
+
+    /** timerfd */
+    int m_timerFd;
+
+    /** called after the last record */
+    EventLoop::Callback m_done;
+
+    /** next record, valid if m_pending */
+    CaptureRecord m_record;
+
+    /** m_record is not fed yet */
+    bool m_pending;
+
+    /** start of replay */
+    std::chrono::steady_clock::time_point m_start;
+
+    /** end of replay */
+    std::chrono::steady_clock::time_point m_end;
+
+    /** number of bytes fed */
+    uint64_t m_bytes;
+
+    /** latency per telegram */
+    std::vector<std::chrono::nanoseconds> m_latencies;
+};
@@ -0,0 +1,68 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "RingBuffer.h"
+
+/* C includes */
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <system_error>
+
+RingBuffer::RingBuffer(size_t capacity) :
+    m_data(nullptr),
+    m_capacity(static_cast<size_t>(sysconf(_SC_PAGESIZE))),
+    m_head(0),
+    m_tail(0)
+{
+    /* a power of two and a multiple of the page size */
+    while (m_capacity < capacity) {
+        m_capacity *= 2;
+    }
+
+    int fd = memfd_create("sml2mqtt-ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "memfd_create");
+    }
+    if (ftruncate(fd, m_capacity) < 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "ftruncate");
+    }
+
+    /* reserve twice the capacity, then map the file into both halves */
+    void * area = mmap(nullptr, 2 * m_capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    m_data = static_cast<unsigned char *>(area);
+    for (int i = 0; i < 2; i++) {
+        if (mmap(m_data + i * m_capacity, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            int error = errno;
+            munmap(m_data, 2 * m_capacity);
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "mmap");
+        }
+    }
+    close(fd);
+}
+
+RingBuffer::~RingBuffer()
+{
+    munmap(m_data, 2 * m_capacity);
+}
@@ -0,0 +1,84 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Byte ring buffer with contiguous read and write regions.
+ *
+ * The buffer memory is mapped twice back to back, so data wrapping around
+ * the end of the buffer can still be accessed as one contiguous region.
+ */
+class RingBuffer
+{
+public:
+    /**
+     * @param[in] capacity capacity in bytes, rounded up to the page size
+     * @throw std::system_error if the buffer can't be mapped
+     */
+    explicit RingBuffer(size_t capacity);
+    virtual ~RingBuffer();
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer & operator=(const RingBuffer &) = delete;
+
+    /** capacity in bytes */
+    size_t capacity() const { return m_capacity; }
+
+    /** start of the free region */
+    unsigned char * writePtr() { return m_data + (m_head & (m_capacity - 1)); }
+
+    /** size of the free region */
+    size_t writable() const { return m_capacity - (m_head - m_tail); }
+
+    /**
+     * mark bytes written to writePtr() as readable
+     *
+     * @param[in] len number of bytes, at most writable()
+     */
+    void commit(size_t len) { m_head += len; }
+
+    /** start of the readable region */
+    unsigned char * readPtr() { return m_data + (m_tail & (m_capacity - 1)); }
+
+    /** size of the readable region */
+    size_t readable() const { return m_head - m_tail; }
+
+    /**
+     * release bytes at the start of the readable region
+     *
+     * @param[in] len number of bytes, at most readable()
+     */
+    void consume(size_t len) { m_tail += len; }
+
+    /** bytes ever consumed, the stream position of readPtr() */
+    uint64_t consumed() const { return m_tail; }
+
+private:
+    /** mapping of twice the capacity */
+    unsigned char * m_data;
+
+    /** capacity, a power of two */
+    size_t m_capacity;
+
+    /** bytes ever written */
+    uint64_t m_head;
+
+    /** bytes ever consumed */
+    uint64_t m_tail;
+};
@@ -26,109 +26,106 @@
 #include "SML.h"
 
 /* C includes */
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 
 /* C++ includes */
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
-#include <iomanip>
+#include <cstring>
 #include <iostream>
-#include <map>
-#include <sstream>
 
+#ifdef WITH_LIBSML
 /* SML library */
 #include <sml/sml_file.h>
-#include <sml/sml_transport.h>
 #include <sml/sml_value.h>
+#endif
 
 /* project internal includes */
-#include "MqttClient.h"
-
-/** units */
-static const std::map<uint8_t, std::string> units = {
-    // code, unit           // Quantity                                     Unit name               SI definition (comment)
-    //=====================================================================================================================
-    {1, "a"},               // time                                         year                    52*7*24*60*60 s
-    {2, "mo"},              // time                                         month                   31*24*60*60 s
-    {3, "wk"},              // time                                         week                    7*24*60*60 s
-    {4, "d"},               // time                                         day                     24*60*60 s
-    {5, "h"},               // time                                         hour                    60*60 s
-    {6, "min."},            // time                                         min                     60 s
-    {7, "s"},               // time (t)                                     second                  s
-    {8, "°"},               // (phase) angle                                degree                  rad*180/π
-    {9, "°C"},              // temperature (T)                              degree celsius          K-273.15
-    {10, "currency"},       // (local) currency
-    {11, "m"},              // length (l)                                   metre                   m
-    {12, "m/s"},            // speed (v)                                    metre per second        m/s
-    {13, "m³"},             // volume (V)                                   cubic metre             m³
-    {14, "m³"},             // corrected volume                             cubic metre             m³
-    {15, "m³/h"},           // volume flux                                  cubic metre per hour    m³/(60*60s)
-    {16, "m³/h"},           // corrected volume flux                        cubic metre per hour    m³/(60*60s)
-    {17, "m³/d"},           // volume flux                                                          m³/(24*60*60s)
-    {18, "m³/d"},           // corrected volume flux                                                m³/(24*60*60s)
-    {19, "l"},              // volume                                       litre                   10-3 m³
-    {20, "kg"},             // mass (m)                                     kilogram
-    {21, "N"},              // force (F)                                    newton
-    {22, "Nm"},             // energy                                       newtonmeter             J = Nm = Ws
-    {23, "Pa"},             // pressure (p)                                 pascal                  N/m²
-    {24, "bar"},            // pressure (p)                                 bar                     10⁵ N/m²
-    {25, "J"},              // energy                                       joule                   J = Nm = Ws
-    {26, "J/h"},            // thermal power                                joule per hour          J/(60*60s)
-    {27, "W"},              // active power (P)                             watt                    W = J/s
-    {28, "VA"},             // apparent power (S)                           volt-ampere
-    {29, "var"},            // reactive power (Q)                           var
-    {30, "Wh"},             // active energy                                watt-hour               W*(60*60s)
-    {31, "VAh"},            // apparent energy                              volt-ampere-hour        VA*(60*60s)
-    {32, "varh"},           // reactive energy                              var-hour                var*(60*60s)
-    {33, "A"},              // current (I)                                  ampere                  A
-    {34, "C"},              // electrical charge (Q)                        coulomb                 C = As
-    {35, "V"},              // voltage (U)                                  volt                    V
-    {36, "V/m"},            // electr. field strength (E)                   volt per metre
-    {37, "F"},              // capacitance (C)                              farad                   C/V = As/V
-    {38, "Ω"},              // resistance (R)                               ohm                     Ω = V/A
-    {39, "Ωm²/m"},          // resistivity (ρ)                              Ωm
-    {40, "Wb"},             // magnetic flux (Φ)                            weber                   Wb = Vs
-    {41, "T"},              // magnetic flux density (B)                    tesla                   Wb/m2
-    {42, "A/m"},            // magnetic field strength (H)                  ampere per metre        A/m
-    {43, "H"},              // inductance (L)                               henry                   H = Wb/A
-    {44, "Hz"},             // frequency (f, ω)                             hertz                   1/s
-    {45, "1/(Wh)"},         // R_W                                                                  (Active energy meter constant or pulse value)
-    {46, "1/(varh)"},       // R_B                                                                  (reactive energy meter constant or pulse value)
-    {47, "1/(VAh)"},        // R_S                                                                  (apparent energy meter constant or pulse value)
-    {48, "V²h"},            // volt-squared hour                            volt-squaredhours       V²(60*60s)
-    {49, "A²h"},            // ampere-squared hour                          ampere-squaredhours     A²(60*60s)
-    {50, "kg/s"},           // mass flux                                    kilogram per second     kg/s
-    {51, "S, mho"},         // conductance siemens                                                  1/Ω
-    {52, "K"},              // temperature (T)                              kelvin
-    {53, "1/(V²h)"},        // R_U²h                                                                (Volt-squared hour meter constant or pulse value)
-    {54, "1/(A²h)"},        // R_I²h                                                                (Ampere-squared hour meter constant or pulse value)
-    {55, "1/m³"},           // R_V, meter constant or pulse value (volume)
-    {56, "%"},              // percentage                                   %
-    {57, "Ah"},             // ampere-hours                                 ampere-hour
-    {60, "Wh/m³"},          // energy per volume                                                    3,6*103 J/m³
-    {61, "J/m³"},           // calorific value, wobbe
-    {62, "Mol %"},          // molar fraction of gas composition            mole percent            (Basic gas composition unit)
-    {63, "g/m³"},           // mass density, quantity of material                                   (Gas analysis, accompanying elements)
-    {64, "Pa s"},           // dynamic viscosity pascal second                                      (Characteristic of gas stream)
-    {253, "(reserved)"},    // reserved
-    {254, "(other)"},       // other unit
-    {255, "(unitless)"}
-};
-
-SML::SML(std::string device) :
+#include "Obis.h"
+
+SML::SML(std::string device, std::string topic, const ObisMap & registers, bool verifyCrc) :
     m_device(device),
-    m_fd(-1)
+    m_topic(topic),
+    m_registers(registers),
+    m_registerTopics(),
+    m_registerHandles(),
+    m_registerFilters(),
+    m_registerAggregates(),
+    m_registerChannels(),
+    m_snapshot(),
+    m_snapshotHandle(0),
+    m_snapshotOnly(false),
+    m_fd(-1),
+    m_capture(nullptr),
+    m_framer(),
+    m_decoder(),
+    m_bytesRead(0),
+    m_framesReceived(0),
+    m_entriesDecoded(0),
+    m_valuesFiltered(0),
+    m_parseDuration(metrics().histogram("sml_parse_duration_seconds", "time to decode a telegram", m_device)),
+    m_readTimes(),
+    m_readCount(0)
 {
     int bits;
     struct termios config;
     memset(&config, 0, sizeof(config));
 
+    m_framer.setVerifyCrc(verifyCrc);
+    m_decoder.setVerifyCrc(verifyCrc);
+
+    /* counted per meter on the reader thread, read by the metrics output */
+    typedef Metrics::Type Type;
+    metrics().callback("sml_bytes_read", "bytes read from the meter", Type::Counter, m_device, this, [this]() { return m_bytesRead; });
+    metrics().callback("sml_telegrams", "telegrams framed", Type::Counter, m_device, this, [this]() { return m_framesReceived; });
+    metrics().callback("sml_frames_dropped", "frames dropped by the framer", Type::Counter, m_device, this, [this]() { return framesDropped(); });
+    metrics().callback("sml_crc_errors", "frames and messages with a wrong CRC", Type::Counter, m_device, this, [this]() { return crcErrors(); });
+    metrics().callback("sml_parse_errors", "telegrams that could not be parsed", Type::Counter, m_device, this, [this]() { return parseErrors(); });
+    metrics().callback("sml_entries_decoded", "OBIS entries decoded", Type::Counter, m_device, this, [this]() { return m_entriesDecoded; });
+    metrics().callback("sml_values_filtered", "register values dropped by their publish policy", Type::Counter, m_device, this, [this]() { return m_valuesFiltered; });
+
+    /* topics are resolved once, publishing a value needs no allocation */
+    for (const ObisRegister & reg : m_registers) {
+        m_registerTopics.push_back(m_topic + "/" + reg.topic);
+        m_registerFilters.emplace_back(reg.policy);
+        if (mqttClient()) {
+            m_registerHandles.push_back(mqttClient()->addTopic(m_registerTopics.back()));
+            if (reg.expiry > 0) {
+                mqttClient()->setExpiry(m_registerHandles.back(), reg.expiry);
+            }
+            if (reg.qos >= 0 || !reg.retain) {
+                mqttClient()->setDelivery(m_registerHandles.back(), reg.qos, reg.retain);
+            }
+        }
+
+        /* aggregates are published as controls "<control> <window> <value>" (e.g. Total Energy 1 h delta) */
+        m_registerAggregates.emplace_back();
+        for (std::chrono::seconds window : reg.aggregate.windows) {
+            RegisterAggregate aggregate = { Aggregator(window), {} };
+            for (AggregateValue value : reg.aggregate.values) {
+                if (mqttClient()) {
+                    aggregate.handles.push_back(mqttClient()->addTopic(m_registerTopics.back() + " " + Aggregator::controlSuffix(window, value)));
+                }
+            }
+            m_registerAggregates.back().push_back(aggregate);
+        }
+    }
+
+    /* no device, data is passed by feed() */
+    if (m_device.empty()) {
+        return;
+    }
+
     m_fd = open(m_device.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
     if (m_fd < 0) {
         std::cerr << "open(" << device << "): " << strerror(errno) << std::endl;
+        return;
     }
 
     // set RTS
@@ -154,7 +151,11 @@ SML::SML(std::string device) :
 
 SML::~SML()
 {
-    close(m_fd);
+    metrics().remove(this);
+
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
 }
 
 bool SML::is_open() const
@@ -162,88 +163,317 @@ bool SML::is_open() const
     return (m_fd > 0);
 }
 
-void SML::transport_listen()
+int SML::fd() const
 {
-    sml_transport_listen(m_fd, [](unsigned char * buffer, size_t buffer_len) {
-        /* check if MQTT client is available */
-        if (!mqttClient()) {
-            return;
+    return m_fd;
+}
+
+const std::string & SML::device() const
+{
+    return m_device;
+}
+
+void SML::publishMeta()
+{
+    if (!mqttClient()) {
+        return;
+    }
+
+    for (std::size_t i = 0; i < m_registers.size(); i++) {
+        if (!m_snapshotOnly) {
+            mqttClient()->setTopic(m_registerTopics[i] + "/meta/type", "text");
+            if (!m_registers[i].unit.empty()) {
+                mqttClient()->setTopic(m_registerTopics[i] + "/meta/unit", m_registers[i].unit);
+            }
+            mqttClient()->setTopic(m_registerTopics[i] + "/meta/order", std::to_string(m_registers[i].order));
+        }
+
+        /* aggregates are ordered after all registers, grouped by register */
+        int order = m_registers[i].order * 100;
+        for (std::chrono::seconds window : m_registers[i].aggregate.windows) {
+            for (AggregateValue value : m_registers[i].aggregate.values) {
+                std::string topic = m_registerTopics[i] + " " + Aggregator::controlSuffix(window, value);
+                mqttClient()->setTopic(topic + "/meta/type", "text");
+                if (!m_registers[i].unit.empty() && value != AggregateValue::Count) {
+                    mqttClient()->setTopic(topic + "/meta/unit", m_registers[i].unit);
+                }
+                mqttClient()->setTopic(topic + "/meta/order", std::to_string(++order));
+            }
+        }
+    }
+}
+
+bool SML::onReadable()
+{
+    for (;;) {
+        /* the framer keeps room for a read, a full buffer would read as end of file */
+        if (m_framer.writable() == 0) {
+            std::cerr << "SML::onReadable: " << m_device << ": receive buffer full, dropped" << std::endl;
+            m_framer.reset();
         }
 
-        /* the buffer contains the whole message and strip transport escape sequences */
-        sml_file *file = sml_file_parse(buffer + 8, buffer_len - 16);
-
-        /* read OBIS data */
-        for (int i = 0; i < file->messages_len; i++) {
-            sml_message *message = file->messages[i];
-            if (*message->message_body->tag == SML_MESSAGE_GET_LIST_RESPONSE) {
-                sml_list *entry;
-                sml_get_list_response *body;
-                body = (sml_get_list_response *) message->message_body->data;
-                for (entry = body->val_list; entry != NULL; entry = entry->next) {
-                    /* check if valid */
-                    if (!entry->value) {
-                        std::cerr << "Error in data stream. entry->value should not be NULL. Skipping this." << std::endl;
-                        continue;
-                    }
-
-                    /* set OBIS string */
-                    std::ostringstream obis;
-                    obis
-                            << static_cast<int>(entry->obj_name->str[0])
-                            << "-"
-                            << static_cast<int>(entry->obj_name->str[1])
-                            << ":"
-                            << static_cast<int>(entry->obj_name->str[2])
-                            << "."
-                            << static_cast<int>(entry->obj_name->str[3])
-                            << "."
-                            << static_cast<int>(entry->obj_name->str[4])
-                            << "*"
-                            << static_cast<int>(entry->obj_name->str[5]);
-
-                    /* set MQTT value based on type */
-                    if (entry->value->type == SML_TYPE_OCTET_STRING) {
-                        char *str;
-                        //mqttClient()->setTopic(topic.str(), sml_value_to_strhex(entry->value, &str, true));
-                        free(str);
-                    } else
-                    if (entry->value->type == SML_TYPE_BOOLEAN) {
-                        //mqttClient()->setTopic(topic.str(), (entry->value->data.boolean ? "1" : "0"));
-                    } else
-                    if (((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_INTEGER) ||
-                               ((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_UNSIGNED)) {
-                        double value = sml_value_to_double(entry->value);
-                        int scaler = (entry->scaler) ? *entry->scaler : 0;
-                        value = value * pow(10, scaler);
-                        /*
-                            {'obis': '1-0:16.7.0*255', 'scale': 1, 'unit': ' W', 'topic': 'Current Power'},
-                        	{'obis': '1-0:1.8.0*255', 'scale': 1000, 'unit': ' kWh', 'topic': 'Total Energy'}
-                        */
-                        if (obis.str() == "1-0:16.7.0*255") {
-                            std::ostringstream valuestr;
-                            valuestr << std::fixed << std::setprecision(1) << value;
-                        	mqttClient()->setTopic("Current Power", valuestr.str());
-                        } else if (obis.str() == "1-0:1.8.0*255") {
-                            value = value / 1000;
-                            std::ostringstream valuestr;
-                            valuestr << std::fixed << std::setprecision(1) << value;
-                        	mqttClient()->setTopic("Total Energy", valuestr.str());
-                        }
-
-                        /* unit is optional */
-                        if (entry->unit) {
-                            uint8_t code = (uint8_t) * entry->unit;
-                            if (units.count(code)) {
-                                //mqttClient()->setTopic(topic.str() + "/$unit", units.at(code));
-                            }
-                        }
-                    }
+        /* read as much as fits, then hand out all complete frames */
+        ssize_t len = read(m_fd, m_framer.writePtr(), m_framer.writable());
+        if (len > 0) {
+            if (m_capture) {
+                m_capture->write(m_framer.writePtr(), len);
+            }
+            commit(len);
+            receiveFrames();
+            continue;
+        }
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (len == 0) {
+            std::cerr << "read(" << m_device << "): end of file" << std::endl;
+        } else {
+            std::cerr << "read(" << m_device << "): " << strerror(errno) << std::endl;
+        }
+        return false;
+    }
+}
+
+void SML::feed(const unsigned char * data, size_t len)
+{
+    while (len > 0) {
+        if (m_framer.writable() == 0) {
+            std::cerr << "SML::feed: receive buffer full, dropped" << std::endl;
+            m_framer.reset();
+        }
+        size_t n = std::min(len, m_framer.writable());
+        memcpy(m_framer.writePtr(), data, n);
+        commit(n);
+        receiveFrames();
+        data += n;
+        len -= n;
+    }
+}
+
+void SML::commit(size_t len)
+{
+    m_bytesRead += len;
+    m_framer.commit(len);
+    m_readTimes[m_readCount++ % m_readTimes.size()] = { m_bytesRead, std::chrono::steady_clock::now() };
+}
+
+void SML::receiveFrames()
+{
+    SmlFrame frame;
+    while (m_framer.next(frame)) {
+        TelegramTrace trace;
+        trace.framed = std::chrono::steady_clock::now();
+
+        /* the first byte came with the oldest read ending after it, or before the remembered reads */
+        uint64_t oldest = m_readCount > m_readTimes.size() ? m_readCount - m_readTimes.size() : 0;
+        uint64_t read = m_readCount;
+        while (read > oldest && m_readTimes[(read - 1) % m_readTimes.size()].end > frame.offset) {
+            read--;
+        }
+        trace.firstByte = m_readTimes[(read < m_readCount ? read : read - 1) % m_readTimes.size()].time;
+        latencyTracer().record(LatencyTracer::Framing, trace.framed - trace.firstByte);
+
+        receive(frame.data, frame.len, trace);
+    }
+}
+
+void SML::receive(unsigned char * buffer, size_t buffer_len, TelegramTrace & trace)
+{
+    /* check if MQTT client is available */
+    if (!mqttClient()) {
+        return;
+    }
+
+    m_framesReceived++;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+#ifdef WITH_LIBSML
+    /* the buffer contains the whole message and strip transport escape sequences */
+    sml_file *file = sml_file_parse(buffer + 8, buffer_len - 16);
+    trace.decoded = std::chrono::steady_clock::now();
+    m_parseDuration.observe(trace.decoded - start);
+    latencyTracer().record(LatencyTracer::Decoding, trace.decoded - trace.framed);
+    mqttClient()->setTrace(&trace);
+    beginSnapshot();
+    bool hasMeterTime = false;
+    uint32_t meterTime = 0;
+
+    /* read OBIS data */
+    for (int i = 0; i < file->messages_len; i++) {
+        sml_message *message = file->messages[i];
+        if (*message->message_body->tag == SML_MESSAGE_GET_LIST_RESPONSE) {
+            sml_list *entry;
+            sml_get_list_response *body;
+            body = (sml_get_list_response *) message->message_body->data;
+            if (!hasMeterTime && body->act_sensor_time && body->act_sensor_time->data.timestamp) {
+                hasMeterTime = true;
+                meterTime = *body->act_sensor_time->data.timestamp;
+            }
+            for (entry = body->val_list; entry != NULL; entry = entry->next) {
+                m_entriesDecoded++;
+
+                /* check if valid */
+                if (!entry->value) {
+                    std::cerr << "Error in data stream. entry->value should not be NULL. Skipping this." << std::endl;
+                    continue;
                 }
+
+                /* look up register by the raw obj_name */
+                ObisCode obis = entry->obj_name ? obisCode(entry->obj_name->str, entry->obj_name->len) : 0;
+                int index = m_registers.indexOf(obis);
+                if (index < 0) {
+                    continue;
+                }
+
+                /* set MQTT value based on type */
+                if (((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_INTEGER) ||
+                           ((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_UNSIGNED)) {
+                    double value = sml_value_to_double(entry->value);
+                    int scaler = (entry->scaler) ? *entry->scaler : 0;
+                    publishRegister(index, value * pow(10, scaler));
+                }
+            }
+        }
+    }
+
+    /* free memory */
+    publishSnapshot(hasMeterTime, meterTime);
+    mqttClient()->commit();
+    mqttClient()->setTrace(nullptr);
+    sml_file_free(file);
+#else
+    /* the buffer contains the whole message and strip transport escape sequences */
+    SmlFile file;
+    bool decoded = m_decoder.decode(buffer + 8, buffer_len - 16, file);
+    trace.decoded = std::chrono::steady_clock::now();
+    m_parseDuration.observe(trace.decoded - start);
+    if (!decoded) {
+        return;
+    }
+    latencyTracer().record(LatencyTracer::Decoding, trace.decoded - trace.framed);
+
+    /* values published below are traced until acknowledged */
+    mqttClient()->setTrace(&trace);
+    beginSnapshot();
+    bool hasMeterTime = false;
+    uint32_t meterTime = 0;
+
+    /* read OBIS data */
+    for (const SmlListResponse * list = file.lists; list != nullptr; list = list->next) {
+        m_entriesDecoded += list->count;
+        if (!hasMeterTime && list->hasActSensorTime) {
+            hasMeterTime = true;
+            meterTime = list->actSensorTime;
+        }
+        for (std::size_t i = 0; i < list->count; i++) {
+            const SmlEntry & entry = list->entries[i];
+
+            /* look up register by the raw obj_name */
+            int index = m_registers.indexOf(obisCode(entry.objName.data, entry.objName.len));
+            if (index < 0) {
+                continue;
+            }
+
+            /* set MQTT value based on type */
+            if (entry.type == SmlType::Integer || entry.type == SmlType::Unsigned) {
+                publishRegister(index, entry.toDouble() * pow(10, entry.scaler));
+            }
+        }
+    }
+    publishSnapshot(hasMeterTime, meterTime);
+    mqttClient()->commit();
+    mqttClient()->setTrace(nullptr);
+#endif
+}
+
+void SML::beginSnapshot()
+{
+    if (m_snapshot) {
+        m_snapshot->begin(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+}
+
+void SML::publishSnapshot(bool hasMeterTime, uint32_t meterTime)
+{
+    /* a snapshot differs by its time, it is always published */
+    if (m_snapshot && m_snapshot->count() > 0) {
+        mqttClient()->setTopic(m_snapshotHandle, m_snapshot->finish(hasMeterTime, meterTime), true);
+    }
+}
+
+void SML::setSnapshot(SnapshotFormat format, bool only)
+{
+    m_snapshot.reset();
+    m_snapshotOnly = false;
+    if (format == SnapshotFormat::None || !mqttClient()) {
+        return;
+    }
+
+    std::vector<std::string> names;
+    for (const ObisRegister & reg : m_registers) {
+        names.push_back(reg.topic);
+    }
+    m_snapshot.reset(new SnapshotEncoder(format, names));
+    m_snapshotHandle = mqttClient()->addTopic(m_topic + "/$snapshot");
+    m_snapshotOnly = only;
+}
+
+void SML::setStore(TimeSeriesStore * store)
+{
+    m_registerChannels.clear();
+    if (!store) {
+        return;
+    }
+
+    /* channels are named by the device, the OBIS code and not the topic, so they survive renaming */
+    std::string meter = m_device.empty() ? "feed" : m_device.substr(m_device.rfind('/') + 1);
+    for (const ObisRegister & reg : m_registers) {
+        m_registerChannels.push_back(&store->channel(TimeSeriesStore::channelName(meter, obisToString(reg.obis))));
+    }
+}
+
+void SML::publishRegister(int index, double value)
+{
+    const ObisRegister & reg = m_registers[index];
+    value /= reg.scale;
+
+    /* every sample is stored, independent of the publish policy */
+    if (!m_registerChannels.empty()) {
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        m_registerChannels[index]->append(now, value);
+    }
+
+    /* aggregate every sample, completed windows are always published */
+    if (!m_registerAggregates[index].empty()) {
+        time_t now = time(nullptr);
+        for (RegisterAggregate & aggregate : m_registerAggregates[index]) {
+            if (!aggregate.aggregator.add(now, value) || aggregate.handles.empty()) {
+                continue;
+            }
+            const AggregateResult & result = aggregate.aggregator.result();
+            for (std::size_t i = 0; i < aggregate.handles.size(); i++) {
+                AggregateValue v = reg.aggregate.values[i];
+                mqttClient()->setTopic(aggregate.handles[i], result.get(v), v == AggregateValue::Count ? 0 : reg.precision, true);
             }
         }
+    }
 
-        /* free memory */
-        sml_file_free(file);
-    });
+    /* the snapshot has every value of the telegram, independent of the publish policy */
+    if (m_snapshot) {
+        m_snapshot->add(index, value, reg.precision);
+        if (m_snapshotOnly) {
+            return;
+        }
+    }
+
+    /* apply the publish policy on the numeric value, before formatting */
+    PublishFilter::Decision decision = m_registerFilters[index].check(value);
+    if (decision == PublishFilter::Decision::Drop) {
+        m_valuesFiltered++;
+        return;
+    }
+    mqttClient()->setTopic(m_registerHandles[index], value, reg.precision, decision == PublishFilter::Decision::Force);
 }
@@ -24,18 +24,220 @@
 /* C includes */
 
 /* C++ includes */
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+/* project internal includes */
+#include "Aggregator.h"
+#include "Capture.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "MqttClient.h"
+#include "ObisMap.h"
+#include "PublishPolicy.h"
+#include "SmlDecoder.h"
+#include "SmlFramer.h"
+#include "Snapshot.h"
+#include "TimeSeries.h"
 
 class SML
 {
 public:
-    SML(std::string device);
+    /**
+     * open the device
+     *
+     * The register topics are registered at mqttClient(), create it first.
+     *
+     * @param[in] device device to read sml messages from (e.g. /dev/vzir0), empty to use feed() only
+     * @param[in] topic MQTT topic to publish to (e.g. /devices/123456-energy/controls)
+     * @param[in] registers OBIS registers to publish
+     * @param[in] verifyCrc drop frames and messages with wrong CRC
+     * @throw std::system_error if the receive buffer can't be created
+     */
+    SML(std::string device, std::string topic, const ObisMap & registers, bool verifyCrc = true);
     virtual ~SML();
 
     bool is_open() const;
-    void transport_listen();
+
+    /** file descriptor of the device, to be watched for EPOLLIN */
+    int fd() const;
+
+    /** device name */
+    const std::string & device() const;
+
+    /** publish HomA meta data (type, unit, order) of all registers */
+    void publishMeta();
+
+    /**
+     * read all available bytes without blocking and publish complete frames
+     *
+     * @return false if the device failed (e.g. was unplugged)
+     */
+    bool onReadable();
+
+    /**
+     * process received bytes that were not read from the device
+     *
+     * @param[in] data raw bytes as received from the meter
+     * @param[in] len length of data
+     */
+    void feed(const unsigned char * data, size_t len);
+
+    /**
+     * record all bytes read from the device
+     *
+     * @param[in] capture capture file (not owned), nullptr to stop recording
+     */
+    void setCapture(CaptureWriter * capture) { m_capture = capture; }
+
+    /**
+     * store all register values in a local time series store
+     *
+     * The channels are named <device name>/<OBIS code> (e.g. vzir0/1-0_1.8.0_255).
+     *
+     * @param[in] store store (not owned), nullptr to stop storing
+     * @throw std::system_error if a channel directory can't be created
+     */
+    void setStore(TimeSeriesStore * store);
+
+    /**
+     * publish all register values of a telegram as one message on <topic>/$snapshot
+     *
+     * Call it before publishMeta().
+     *
+     * @param[in] format encoding, None to disable
+     * @param[in] only do not publish the registers as single controls
+     */
+    void setSnapshot(SnapshotFormat format, bool only);
+
+    /** number of bytes read */
+    uint64_t bytesRead() const { return m_bytesRead; }
+
+    /** number of frames received */
+    uint64_t framesReceived() const { return m_framesReceived; }
+
+    /** number of OBIS entries decoded */
+    uint64_t entriesDecoded() const { return m_entriesDecoded; }
+
+    /** number of register values dropped by their publish policy */
+    uint64_t valuesFiltered() const { return m_valuesFiltered; }
+
+    /** number of frames dropped by the framer, including frame CRC errors */
+    uint64_t framesDropped() const { return m_framer.droppedFrames(); }
+
+    /** number of frames that could not be parsed */
+    uint64_t parseErrors() const { return m_decoder.errors(); }
+
+    /** number of frames rejected because of a frame or message CRC error */
+    uint64_t crcErrors() const { return m_framer.crcErrors() + m_decoder.crcErrors(); }
 
 private:
+    /**
+     * pass bytes written to the framer's writePtr() to the framer
+     *
+     * @param[in] len number of bytes
+     */
+    void commit(size_t len);
+
+    /** parse and publish all complete frames in the framer */
+    void receiveFrames();
+
+    /**
+     * parse a received SML file and publish the mapped registers
+     *
+     * @param[in] buffer whole message including transport escape sequences
+     * @param[in] buffer_len length of buffer
+     * @param[in,out] trace timestamps of the telegram, decoded is set
+     */
+    void receive(unsigned char * buffer, size_t buffer_len, TelegramTrace & trace);
+
+    /**
+     * publish the value of a register
+     *
+     * @param[in] index register index
+     * @param[in] value value, scaler already applied
+     */
+    void publishRegister(int index, double value);
+
+    /** start the snapshot of a telegram, if enabled */
+    void beginSnapshot();
+
+    /**
+     * publish the snapshot of a telegram, if enabled and not empty
+     *
+     * @param[in] hasMeterTime meterTime is set
+     * @param[in] meterTime actSensorTime of the meter
+     */
+    void publishSnapshot(bool hasMeterTime, uint32_t meterTime);
+
     std::string m_device;
+    std::string m_topic;
+    ObisMap m_registers;
+
+    /** full topic per register */
+    std::vector<std::string> m_registerTopics;
+
+    /** topic handle per register */
+    std::vector<MqttClient::TopicHandle> m_registerHandles;
+
+    /** publish policy state per register */
+    std::vector<PublishFilter> m_registerFilters;
+
+    /** aggregation window of a register */
+    struct RegisterAggregate
+    {
+        /** aggregator */
+        Aggregator aggregator;
+
+        /** topic handle per configured value */
+        std::vector<MqttClient::TopicHandle> handles;
+    };
+
+    /** aggregation windows per register */
+    std::vector<std::vector<RegisterAggregate>> m_registerAggregates;
+
+    /** time series channel per register, empty if not stored */
+    std::vector<TimeSeriesWriter *> m_registerChannels;
+
+    /** snapshot of the current telegram, nullptr if disabled */
+    std::unique_ptr<SnapshotEncoder> m_snapshot;
+
+    /** topic handle of the snapshot */
+    MqttClient::TopicHandle m_snapshotHandle;
+
+    /** registers are only published in the snapshot */
+    bool m_snapshotOnly;
+
     int m_fd;
+    CaptureWriter * m_capture;
+    SmlFramer m_framer;
+    SmlDecoder m_decoder;
+    uint64_t m_bytesRead;
+    uint64_t m_framesReceived;
+    uint64_t m_entriesDecoded;
+    uint64_t m_valuesFiltered;
+
+    /** decode duration per telegram */
+    Histogram & m_parseDuration;
+
+    /** time of a read, to find when the first byte of a frame arrived */
+    struct ReadTime
+    {
+        /** stream position after the read */
+        uint64_t end;
+
+        /** time of the read */
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /** the last reads, a ring indexed by m_readCount */
+    std::array<ReadTime, 64> m_readTimes;
+
+    /** number of reads */
+    uint64_t m_readCount;
 };
@@ -0,0 +1,427 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "SmlDecoder.h"
+
+/* project internal includes */
+#include "Crc16.h"
+
+/** end of message marker */
+static const unsigned char endOfMessage = 0x00;
+
+SmlDecoder::SmlDecoder(size_t arenaSize) :
+    m_arena(arenaSize),
+    m_cursor(nullptr),
+    m_end(nullptr),
+    m_verifyCrc(true),
+    m_errors(0),
+    m_crcErrors(0)
+{
+}
+
+bool SmlDecoder::decode(const unsigned char * data, size_t len, SmlFile & file)
+{
+    m_arena.reset();
+    m_cursor = data;
+    m_end = data + len;
+
+    file.lists = nullptr;
+    file.messages = 0;
+    SmlListResponse * last = nullptr;
+
+    while (m_cursor < m_end) {
+        /* padding between messages and at the end */
+        if (*m_cursor == endOfMessage) {
+            m_cursor++;
+            continue;
+        }
+
+        SmlListResponse * list = nullptr;
+        bool crcError = false;
+        if (!readMessage(list, crcError)) {
+            if (crcError) {
+                m_crcErrors++;
+            } else {
+                m_errors++;
+            }
+            return false;
+        }
+        file.messages++;
+        if (list) {
+            if (last) {
+                last->next = list;
+            } else {
+                file.lists = list;
+            }
+            last = list;
+        }
+    }
+    return true;
+}
+
+bool SmlDecoder::readTypeLength(TypeLength & tl)
+{
+    if (m_cursor >= m_end) {
+        return false;
+    }
+
+    unsigned char byte = *m_cursor++;
+    SmlType type = static_cast<SmlType>(byte & 0x70);
+    size_t len = byte & 0x0f;
+    size_t tlLen = 1;
+    while (byte & 0x80) {
+        if (m_cursor >= m_end || tlLen >= sizeof(uint32_t)) {
+            return false;
+        }
+        byte = *m_cursor++;
+        len = (len << 4) | (byte & 0x0f);
+        tlLen++;
+    }
+
+    switch (type) {
+    case SmlType::List:
+        tl.type = type;
+        tl.len = len;
+        return true;
+    case SmlType::OctetString:
+    case SmlType::Boolean:
+    case SmlType::Integer:
+    case SmlType::Unsigned:
+        /* the length includes the type length field */
+        if (len < tlLen || len - tlLen > static_cast<size_t>(m_end - m_cursor)) {
+            return false;
+        }
+        tl.type = (type == SmlType::OctetString && len == tlLen) ? SmlType::None : type;
+        tl.len = len - tlLen;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool SmlDecoder::skip()
+{
+    /* iterative, count the elements still to skip, each needs at least one byte */
+    size_t pending = 1;
+    while (pending > 0) {
+        TypeLength tl;
+        if (!readTypeLength(tl)) {
+            return false;
+        }
+        pending--;
+        if (tl.type == SmlType::List) {
+            pending += tl.len;
+            if (pending > static_cast<size_t>(m_end - m_cursor)) {
+                return false;
+            }
+        } else {
+            m_cursor += tl.len;
+        }
+    }
+    return true;
+}
+
+bool SmlDecoder::readOctets(SmlOctets & octets)
+{
+    TypeLength tl;
+    if (!readTypeLength(tl)) {
+        return false;
+    }
+    if (tl.type == SmlType::None) {
+        octets.data = nullptr;
+        octets.len = 0;
+        return true;
+    }
+    if (tl.type != SmlType::OctetString) {
+        return false;
+    }
+    octets.data = m_cursor;
+    octets.len = tl.len;
+    m_cursor += tl.len;
+    return true;
+}
+
+bool SmlDecoder::readUnsigned(uint64_t & value, bool & isSet)
+{
+    TypeLength tl;
+    if (!readTypeLength(tl)) {
+        return false;
+    }
+    value = 0;
+    isSet = (tl.type != SmlType::None);
+    if (!isSet) {
+        return true;
+    }
+    if ((tl.type != SmlType::Unsigned && tl.type != SmlType::Integer) || tl.len > 8) {
+        return false;
+    }
+    for (size_t i = 0; i < tl.len; i++) {
+        value = (value << 8) | *m_cursor++;
+    }
+    return true;
+}
+
+bool SmlDecoder::readTime(uint32_t & value, bool & isSet)
+{
+    const unsigned char * start = m_cursor;
+    TypeLength tl;
+    if (!readTypeLength(tl)) {
+        return false;
+    }
+
+    uint64_t time = 0;
+    isSet = (tl.type != SmlType::None);
+    if (tl.type == SmlType::List) {
+        /* choice (secIndex, timestamp, localTimestamp) and value */
+        uint64_t choice;
+        bool choiceSet;
+        if (tl.len < 2 || !readUnsigned(choice, choiceSet)) {
+            return false;
+        }
+        TypeLength valueTl;
+        const unsigned char * valueStart = m_cursor;
+        if (!readTypeLength(valueTl)) {
+            return false;
+        }
+        if (valueTl.type == SmlType::List) {
+            /* localTimestamp: timestamp, local offset, season offset */
+            if (valueTl.len < 1 || !readUnsigned(time, isSet)) {
+                return false;
+            }
+            for (size_t i = 1; i < valueTl.len; i++) {
+                if (!skip()) {
+                    return false;
+                }
+            }
+        } else {
+            m_cursor = valueStart;
+            if (!readUnsigned(time, isSet)) {
+                return false;
+            }
+        }
+        for (size_t i = 2; i < tl.len; i++) {
+            if (!skip()) {
+                return false;
+            }
+        }
+    } else
+    if (isSet) {
+        m_cursor = start;
+        if (!readUnsigned(time, isSet)) {
+            return false;
+        }
+    }
+    value = static_cast<uint32_t>(time);
+    return true;
+}
+
+bool SmlDecoder::readValue(SmlEntry & entry)
+{
+    const unsigned char * start = m_cursor;
+    TypeLength tl;
+    if (!readTypeLength(tl)) {
+        return false;
+    }
+
+    entry.type = tl.type;
+    entry.integer = 0;
+    entry.unsignedInteger = 0;
+    entry.octets.data = nullptr;
+    entry.octets.len = 0;
+    switch (tl.type) {
+    case SmlType::None:
+        break;
+    case SmlType::OctetString:
+        entry.octets.data = m_cursor;
+        entry.octets.len = tl.len;
+        m_cursor += tl.len;
+        break;
+    case SmlType::Boolean:
+        if (tl.len != 1) {
+            return false;
+        }
+        entry.integer = (*m_cursor++ != 0) ? 1 : 0;
+        break;
+    case SmlType::Integer:
+        if (tl.len < 1 || tl.len > 8) {
+            return false;
+        }
+        /* sign extend */
+        entry.integer = static_cast<int8_t>(*m_cursor++);
+        for (size_t i = 1; i < tl.len; i++) {
+            entry.integer = static_cast<int64_t>(static_cast<uint64_t>(entry.integer) << 8) | *m_cursor++;
+        }
+        break;
+    case SmlType::Unsigned:
+        if (tl.len > 8) {
+            return false;
+        }
+        for (size_t i = 0; i < tl.len; i++) {
+            entry.unsignedInteger = (entry.unsignedInteger << 8) | *m_cursor++;
+        }
+        break;
+    case SmlType::List:
+        /* not a scalar, skip it */
+        m_cursor = start;
+        entry.type = SmlType::None;
+        return skip();
+    }
+    return true;
+}
+
+bool SmlDecoder::readEntry(SmlEntry & entry)
+{
+    TypeLength tl;
+    if (!readTypeLength(tl) || tl.type != SmlType::List || tl.len != 7) {
+        return false;
+    }
+
+    /* objName */
+    if (!readOctets(entry.objName)) {
+        return false;
+    }
+
+    /* status, not used */
+    if (!skip()) {
+        return false;
+    }
+
+    /* valTime */
+    if (!readTime(entry.valTime, entry.hasValTime)) {
+        return false;
+    }
+
+    /* unit */
+    uint64_t value;
+    if (!readUnsigned(value, entry.hasUnit)) {
+        return false;
+    }
+    entry.unit = static_cast<uint8_t>(value);
+
+    /* scaler */
+    bool hasScaler;
+    if (!readUnsigned(value, hasScaler)) {
+        return false;
+    }
+    entry.scaler = static_cast<int8_t>(value);
+
+    /* value */
+    if (!readValue(entry)) {
+        return false;
+    }
+
+    /* valueSignature, not used */
+    return skip();
+}
+
+bool SmlDecoder::readListResponse(SmlListResponse & list)
+{
+    TypeLength tl;
+    if (!readTypeLength(tl) || tl.type != SmlType::List || tl.len != 7) {
+        return false;
+    }
+
+    /* clientId */
+    SmlOctets octets;
+    if (!readOctets(octets)) {
+        return false;
+    }
+
+    /* serverId */
+    if (!readOctets(list.serverId)) {
+        return false;
+    }
+
+    /* listName */
+    if (!readOctets(octets)) {
+        return false;
+    }
+
+    /* actSensorTime */
+    if (!readTime(list.actSensorTime, list.hasActSensorTime)) {
+        return false;
+    }
+
+    /* valList, the entries become one contiguous array */
+    TypeLength entries;
+    if (!readTypeLength(entries) || entries.type != SmlType::List || entries.len > static_cast<size_t>(m_end - m_cursor)) {
+        return false;
+    }
+    SmlEntry * entry = m_arena.allocate<SmlEntry>(entries.len);
+    for (size_t i = 0; i < entries.len; i++) {
+        if (!readEntry(entry[i])) {
+            return false;
+        }
+    }
+    list.entries = entry;
+    list.count = entries.len;
+
+    /* listSignature, actGatewayTime */
+    return skip() && skip();
+}
+
+bool SmlDecoder::readMessage(SmlListResponse * & list, bool & crcError)
+{
+    const unsigned char * start = m_cursor;
+    TypeLength tl;
+    if (!readTypeLength(tl) || tl.type != SmlType::List || tl.len != 6) {
+        return false;
+    }
+
+    /* transactionId, groupNo, abortOnError */
+    for (int i = 0; i < 3; i++) {
+        if (!skip()) {
+            return false;
+        }
+    }
+
+    /* messageBody: tag and body */
+    TypeLength body;
+    uint64_t tag;
+    bool isSet;
+    if (!readTypeLength(body) || body.type != SmlType::List || body.len != 2 || !readUnsigned(tag, isSet)) {
+        return false;
+    }
+    if (tag == SML_GET_LIST_RESPONSE) {
+        list = m_arena.allocate<SmlListResponse>(1);
+        list->next = nullptr;
+        if (!readListResponse(*list)) {
+            return false;
+        }
+    } else
+    if (!skip()) {
+        return false;
+    }
+
+    /* crc16 over the message up to the crc, transmitted low byte first */
+    size_t crcLen = m_cursor - start;
+    uint64_t crc;
+    if (!readUnsigned(crc, isSet)) {
+        return false;
+    }
+    if (m_verifyCrc && isSet) {
+        uint16_t expected = crc16(start, crcLen);
+        if (crc != static_cast<uint16_t>((expected << 8) | (expected >> 8))) {
+            crcError = true;
+            return false;
+        }
+    }
+
+    /* endOfSmlMsg */
+    if (m_cursor >= m_end || *m_cursor != endOfMessage) {
+        return false;
+    }
+    m_cursor++;
+    return true;
+}
@@ -0,0 +1,219 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+
+/* project internal includes */
+#include "Arena.h"
+
+/** SML message body tag of GetListResponse */
+static const uint32_t SML_GET_LIST_RESPONSE = 0x00000701;
+
+/** type of a decoded value, as in the SML type length field */
+enum class SmlType : uint8_t
+{
+    OctetString = 0x00,
+    Boolean = 0x40,
+    Integer = 0x50,
+    Unsigned = 0x60,
+    List = 0x70,
+
+    /** optional value not set */
+    None = 0xff
+};
+
+/** view of an octet string inside the decoded file */
+struct SmlOctets
+{
+    const unsigned char * data;
+    size_t len;
+};
+
+/** view of a GetListResponse list entry */
+struct SmlEntry
+{
+    /** OBIS code */
+    SmlOctets objName;
+
+    /** type of value */
+    SmlType type;
+
+    /** unit is set */
+    bool hasUnit;
+
+    /** DLMS unit code */
+    uint8_t unit;
+
+    /** scaler, 0 if not set */
+    int8_t scaler;
+
+    /** value time is set */
+    bool hasValTime;
+
+    /** value time (seconds index or timestamp) */
+    uint32_t valTime;
+
+    /** value of type Integer or Boolean (0, 1) */
+    int64_t integer;
+
+    /** value of type Unsigned */
+    uint64_t unsignedInteger;
+
+    /** value of type OctetString */
+    SmlOctets octets;
+
+    /** numeric value without scaler */
+    double toDouble() const
+    {
+        return (type == SmlType::Unsigned) ? static_cast<double>(unsignedInteger) : static_cast<double>(integer);
+    }
+};
+
+/** view of a GetListResponse */
+struct SmlListResponse
+{
+    /** server id (meter id) */
+    SmlOctets serverId;
+
+    /** actSensorTime is set */
+    bool hasActSensorTime;
+
+    /** actSensorTime (seconds index or timestamp) */
+    uint32_t actSensorTime;
+
+    /** list entries */
+    const SmlEntry * entries;
+
+    /** number of entries */
+    size_t count;
+
+    /** next GetListResponse of the same file */
+    const SmlListResponse * next;
+};
+
+/** view of a decoded SML file */
+struct SmlFile
+{
+    /** first GetListResponse, other message bodies are skipped */
+    const SmlListResponse * lists;
+
+    /** number of messages */
+    size_t messages;
+};
+
+/**
+ * Decoder of SML files (type length value encoding).
+ *
+ * Decoded data is placed in a per telegram arena, which is reset on the
+ * next decode(). Octet strings point into the decoded buffer. Only
+ * GetListResponse bodies are materialised, other bodies are skipped.
+ * Files with a message CRC error are rejected.
+ */
+class SmlDecoder
+{
+public:
+    /** @param[in] arenaSize initial arena size */
+    explicit SmlDecoder(size_t arenaSize = 4096);
+
+    /**
+     * decode a SML file
+     *
+     * The views in file are valid until the next decode() and as long as
+     * data is unchanged.
+     *
+     * @param[in] data SML file (frame without transport escape sequences)
+     * @param[in] len length of data
+     * @param[out] file decoded file
+     * @return false if the file is malformed or a message CRC is wrong
+     */
+    bool decode(const unsigned char * data, size_t len, SmlFile & file);
+
+    /**
+     * enable or disable the message CRC check, it is enabled by default
+     *
+     * @param[in] verify check the CRC
+     */
+    void setVerifyCrc(bool verify) { m_verifyCrc = verify; }
+
+    /** number of files rejected because they are malformed */
+    uint64_t errors() const { return m_errors; }
+
+    /** number of files rejected because of a message CRC error */
+    uint64_t crcErrors() const { return m_crcErrors; }
+
+private:
+    /** type length field */
+    struct TypeLength
+    {
+        /** type */
+        SmlType type;
+
+        /** number of value bytes, or number of elements of a list */
+        size_t len;
+    };
+
+    /** read a type length field */
+    bool readTypeLength(TypeLength & tl);
+
+    /** skip an element including all children of a list */
+    bool skip();
+
+    /** read an octet string, an empty one means not set */
+    bool readOctets(SmlOctets & octets);
+
+    /** read an unsigned integer (not set reads as 0) */
+    bool readUnsigned(uint64_t & value, bool & isSet);
+
+    /** read a time, either a list of choice and value or a plain value */
+    bool readTime(uint32_t & value, bool & isSet);
+
+    /** read a value of any scalar type */
+    bool readValue(SmlEntry & entry);
+
+    /** read a GetListResponse body */
+    bool readListResponse(SmlListResponse & list);
+
+    /** read a list entry */
+    bool readEntry(SmlEntry & entry);
+
+    /**
+     * read a message
+     *
+     * @param[out] list GetListResponse, not changed for other messages
+     * @param[out] crcError set if the message is rejected because of its CRC
+     */
+    bool readMessage(SmlListResponse * & list, bool & crcError);
+
+    /** arena for the decoded file */
+    Arena m_arena;
+
+    /** current position */
+    const unsigned char * m_cursor;
+
+    /** end of data */
+    const unsigned char * m_end;
+
+    /** check the message CRC */
+    bool m_verifyCrc;
+
+    /** number of malformed files */
+    uint64_t m_errors;
+
+    /** number of files with message CRC errors */
+    uint64_t m_crcErrors;
+};
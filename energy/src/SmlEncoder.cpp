@@ -0,0 +1,238 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "SmlEncoder.h"
+
+/* C++ includes */
+#include <algorithm>
+
+/* project internal includes */
+#include "Crc16.h"
+
+/** message body tags */
+static const uint32_t openResponseTag = 0x00000101;
+static const uint32_t closeResponseTag = 0x00000201;
+static const uint32_t getListResponseTag = 0x00000701;
+
+/** type bits of the type length field */
+static const uint8_t typeOctetString = 0x00;
+static const uint8_t typeInteger = 0x50;
+static const uint8_t typeUnsigned = 0x60;
+static const uint8_t typeList = 0x70;
+
+/** escape sequence */
+static const unsigned char escapeSequence[4] = { 0x1b, 0x1b, 0x1b, 0x1b };
+
+/**
+ * smallest integer size (1, 2, 4 or 8 bytes) holding a value
+ *
+ * @param[in] value value
+ * @param[in] isSigned value is signed
+ * @return size in bytes
+ */
+static size_t integerSize(int64_t value, bool isSigned)
+{
+    for (size_t size = 1; size < 8; size *= 2) {
+        int64_t limit = static_cast<int64_t>(1) << (8 * size - (isSigned ? 1 : 0));
+        if (isSigned ? (value >= -limit && value < limit) : (value >= 0 && value < limit)) {
+            return size;
+        }
+    }
+    return 8;
+}
+
+SmlEncoder::SmlEncoder() :
+    m_file(),
+    m_messageStart(0),
+    m_transactionId(0),
+    m_groupNo(0)
+{
+}
+
+void SmlEncoder::clear()
+{
+    m_file.clear();
+    m_groupNo = 0;
+}
+
+void SmlEncoder::openResponse(const std::string & serverId, const std::string & reqFileId)
+{
+    beginMessage(openResponseTag);
+    writeList(6);
+    writeNone();                /* codepage */
+    writeNone();                /* clientId */
+    writeOctets(reqFileId);
+    writeOctets(serverId);
+    writeNone();                /* refTime */
+    writeNone();                /* smlVersion */
+    endMessage();
+}
+
+void SmlEncoder::getListResponse(const std::string & serverId, uint32_t secIndex, const std::vector<Entry> & entries)
+{
+    beginMessage(getListResponseTag);
+    writeList(7);
+    writeNone();                /* clientId */
+    writeOctets(serverId);
+    writeNone();                /* listName */
+    writeList(2);               /* actSensorTime */
+    writeUnsigned(1, 1);        /* secIndex */
+    writeUnsigned(secIndex, 4);
+    writeList(entries.size());
+    for (const Entry & entry : entries) {
+        std::string objName;
+        for (int shift = 40; shift >= 0; shift -= 8) {
+            objName += static_cast<char>((entry.obis >> shift) & 0xff);
+        }
+        writeList(7);
+        writeOctets(objName);
+        writeNone();            /* status */
+        writeNone();            /* valTime */
+        if (entry.unit) {
+            writeUnsigned(entry.unit, 1);
+        } else {
+            writeNone();
+        }
+        writeInteger(entry.scaler, 1);
+        if (entry.isSigned) {
+            writeInteger(entry.value, integerSize(entry.value, true));
+        } else {
+            writeUnsigned(entry.value, integerSize(entry.value, false));
+        }
+        writeNone();            /* valueSignature */
+    }
+    writeNone();                /* listSignature */
+    writeNone();                /* actGatewayTime */
+    endMessage();
+}
+
+void SmlEncoder::closeResponse()
+{
+    beginMessage(closeResponseTag);
+    writeList(1);
+    writeNone();                /* globalSignature */
+    endMessage();
+}
+
+void SmlEncoder::frame(std::vector<unsigned char> & frame) const
+{
+    frame.assign(escapeSequence, escapeSequence + 4);
+    frame.insert(frame.end(), 4, 0x01);
+
+    /* escape sequences in the payload are doubled, they are 4 byte aligned */
+    size_t padding = (4 - m_file.size() % 4) % 4;
+    for (size_t i = 0; i < m_file.size(); i += 4) {
+        unsigned char block[4] = { 0, 0, 0, 0 };
+        for (size_t k = 0; k < 4 && i + k < m_file.size(); k++) {
+            block[k] = m_file[i + k];
+        }
+        frame.insert(frame.end(), block, block + 4);
+        if (std::equal(block, block + 4, escapeSequence)) {
+            frame.insert(frame.end(), escapeSequence, escapeSequence + 4);
+        }
+    }
+
+    frame.insert(frame.end(), escapeSequence, escapeSequence + 4);
+    frame.push_back(0x1a);
+    frame.push_back(static_cast<unsigned char>(padding));
+    uint16_t crc = crc16(frame.data(), frame.size());
+    frame.push_back(crc & 0xff);
+    frame.push_back(crc >> 8);
+}
+
+void SmlEncoder::beginMessage(uint32_t tag)
+{
+    m_messageStart = m_file.size();
+    std::string transactionId;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        transactionId += static_cast<char>((m_transactionId >> shift) & 0xff);
+    }
+    m_transactionId++;
+
+    writeList(6);
+    writeOctets(transactionId);
+    writeUnsigned(m_groupNo++, 1);
+    writeUnsigned(0, 1);        /* abortOnError */
+    writeList(2);               /* messageBody */
+    writeUnsigned(tag, 4);
+}
+
+void SmlEncoder::endMessage()
+{
+    /* the CRC is transmitted low byte first */
+    uint16_t crc = crc16(&m_file[m_messageStart], m_file.size() - m_messageStart);
+    writeUnsigned(static_cast<uint16_t>((crc << 8) | (crc >> 8)), 2);
+    m_file.push_back(0x00);     /* endOfSmlMsg */
+}
+
+void SmlEncoder::writeTypeLength(uint8_t type, size_t len)
+{
+    /* the length of scalars includes the type length field itself */
+    size_t count = 1;
+    size_t total = len;
+    if (type != typeList) {
+        while (len + count >= (static_cast<size_t>(1) << (4 * count))) {
+            count++;
+        }
+        total = len + count;
+    } else {
+        while (len >= (static_cast<size_t>(1) << (4 * count))) {
+            count++;
+        }
+    }
+
+    for (size_t i = count; i > 0; i--) {
+        unsigned char byte = (total >> (4 * (i - 1))) & 0x0f;
+        if (i == count) {
+            byte |= type;
+        }
+        if (i > 1) {
+            byte |= 0x80;
+        }
+        m_file.push_back(byte);
+    }
+}
+
+void SmlEncoder::writeOctets(const std::string & octets)
+{
+    writeTypeLength(typeOctetString, octets.size());
+    m_file.insert(m_file.end(), octets.begin(), octets.end());
+}
+
+void SmlEncoder::writeUnsigned(uint64_t value, size_t size)
+{
+    writeTypeLength(typeUnsigned, size);
+    for (size_t i = size; i > 0; i--) {
+        m_file.push_back((value >> (8 * (i - 1))) & 0xff);
+    }
+}
+
+void SmlEncoder::writeInteger(int64_t value, size_t size)
+{
+    writeTypeLength(typeInteger, size);
+    for (size_t i = size; i > 0; i--) {
+        m_file.push_back((static_cast<uint64_t>(value) >> (8 * (i - 1))) & 0xff);
+    }
+}
+
+void SmlEncoder::writeList(size_t count)
+{
+    writeTypeLength(typeList, count);
+}
+
+void SmlEncoder::writeNone()
+{
+    m_file.push_back(0x01);
+}
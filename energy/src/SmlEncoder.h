@@ -0,0 +1,128 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* project internal includes */
+#include "Obis.h"
+
+/**
+ * Encoder of SML telegrams as sent by meters.
+ *
+ * A file of OpenResponse, GetListResponse and CloseResponse is built
+ * message by message, each with its CRC, and wrapped into a transport
+ * (version 1) frame with escaping, padding and frame CRC.
+ */
+class SmlEncoder
+{
+public:
+    /** GetListResponse entry */
+    struct Entry
+    {
+        /** OBIS code */
+        ObisCode obis;
+
+        /** DLMS unit code, 0 if not set */
+        uint8_t unit;
+
+        /** scaler */
+        int8_t scaler;
+
+        /** encode as Integer, otherwise as Unsigned */
+        bool isSigned;
+
+        /** value */
+        int64_t value;
+    };
+
+    SmlEncoder();
+
+    /** start a new file */
+    void clear();
+
+    /**
+     * add an OpenResponse
+     *
+     * @param[in] serverId server id
+     * @param[in] reqFileId request file id
+     */
+    void openResponse(const std::string & serverId, const std::string & reqFileId);
+
+    /**
+     * add a GetListResponse
+     *
+     * @param[in] serverId server id
+     * @param[in] secIndex actSensorTime (seconds index)
+     * @param[in] entries list entries
+     */
+    void getListResponse(const std::string & serverId, uint32_t secIndex, const std::vector<Entry> & entries);
+
+    /** add a CloseResponse */
+    void closeResponse();
+
+    /**
+     * wrap the file into a transport frame
+     *
+     * @param[out] frame escaped frame, including start and end sequence
+     */
+    void frame(std::vector<unsigned char> & frame) const;
+
+private:
+    /**
+     * start a message, finished by endMessage()
+     *
+     * @param[in] tag message body tag
+     */
+    void beginMessage(uint32_t tag);
+
+    /** append CRC and end of message */
+    void endMessage();
+
+    /** type length field, len is the number of value bytes or list elements */
+    void writeTypeLength(uint8_t type, size_t len);
+
+    /** octet string */
+    void writeOctets(const std::string & octets);
+
+    /** unsigned integer of size bytes */
+    void writeUnsigned(uint64_t value, size_t size);
+
+    /** signed integer of size bytes */
+    void writeInteger(int64_t value, size_t size);
+
+    /** list of count elements */
+    void writeList(size_t count);
+
+    /** optional value not set */
+    void writeNone();
+
+    /** file */
+    std::vector<unsigned char> m_file;
+
+    /** start of the current message */
+    size_t m_messageStart;
+
+    /** transaction id of the next message */
+    uint32_t m_transactionId;
+
+    /** group number of the file */
+    uint8_t m_groupNo;
+};
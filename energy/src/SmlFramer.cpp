@@ -0,0 +1,255 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "SmlFramer.h"
+
+/* C includes */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* C++ includes */
+#include <cstring>
+
+/* project internal includes */
+#include "Crc16.h"
+
+/** escape sequence */
+static const unsigned char escapeSequence[4] = { 0x1b, 0x1b, 0x1b, 0x1b };
+
+/** version 1 start sequence following an escape sequence */
+static const unsigned char versionSequence[4] = { 0x01, 0x01, 0x01, 0x01 };
+
+/** length of start and end sequence */
+static const size_t sequenceLen = 8;
+
+/** not found */
+static const size_t npos = static_cast<size_t>(-1);
+
+/**
+ * find the first escape sequence (four 0x1b) at any alignment
+ *
+ * @param[in] data data
+ * @param[in] len length of data
+ * @return offset of escape sequence, or npos if not found
+ */
+static size_t findEscape(const unsigned char * data, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* and four shifted compares, so a bit is only set where four 0x1b start */
+    const __m128i esc = _mm_set1_epi8(0x1b);
+    for (; i + 19 <= len; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), esc);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1)), esc);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 2)), esc);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 3)), esc);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    /* same as SSE2, the mask is narrowed to four bits per byte */
+    const uint8x16_t esc = vdupq_n_u8(0x1b);
+    for (; i + 19 <= len; i += 16) {
+        uint8x16_t a = vceqq_u8(vld1q_u8(data + i), esc);
+        uint8x16_t b = vceqq_u8(vld1q_u8(data + i + 1), esc);
+        uint8x16_t c = vceqq_u8(vld1q_u8(data + i + 2), esc);
+        uint8x16_t d = vceqq_u8(vld1q_u8(data + i + 3), esc);
+        uint8x16_t match = vandq_u8(vandq_u8(a, b), vandq_u8(c, d));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+        if (mask) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+
+    /* remainder, or everything without SIMD */
+    while (i + 4 <= len) {
+        const unsigned char * p = static_cast<const unsigned char *>(memchr(data + i, 0x1b, len - 3 - i));
+        if (!p) {
+            break;
+        }
+        i = p - data;
+        if (p[1] == 0x1b && p[2] == 0x1b && p[3] == 0x1b) {
+            return i;
+        }
+        i++;
+    }
+    return npos;
+}
+
+SmlFramer::SmlFramer(size_t bufferSize, size_t maxFrameLen) :
+    m_buffer(bufferSize),
+    m_maxFrameLen(maxFrameLen),
+    m_verifyCrc(true),
+    m_inFrame(false),
+    m_scan(0),
+    m_consume(0),
+    m_escapes(),
+    m_droppedFrames(0),
+    m_crcErrors(0)
+{
+    /* a partial frame must always fit besides the next read */
+    if (m_maxFrameLen > m_buffer.capacity() / 2) {
+        m_maxFrameLen = m_buffer.capacity() / 2;
+    }
+    m_escapes.reserve(64);
+}
+
+bool SmlFramer::next(SmlFrame & frame)
+{
+    /* release the previous frame */
+    m_buffer.consume(m_consume);
+    m_consume = 0;
+
+    for (;;) {
+        unsigned char * data = m_buffer.readPtr();
+        size_t len = m_buffer.readable();
+
+        size_t offset = (m_scan < len) ? findEscape(data + m_scan, len - m_scan) : npos;
+        if (offset == npos) {
+            /* continue with the last bytes, they might start an escape sequence */
+            size_t scan = (len > 3) ? len - 3 : 0;
+            if (!m_inFrame) {
+                m_buffer.consume(scan);
+                m_scan = 0;
+            } else
+            if (len > m_maxFrameLen) {
+                resync();
+                continue;
+            } else
+            if (scan > m_scan) {
+                m_scan = scan;
+            }
+            return false;
+        }
+        size_t pos = m_scan + offset;
+
+        /* escape sequences are followed by four bytes */
+        if (pos + 8 > len) {
+            if (!m_inFrame) {
+                m_buffer.consume(pos);
+                m_scan = 0;
+            } else
+            if (len > m_maxFrameLen) {
+                resync();
+                continue;
+            } else {
+                m_scan = pos;
+            }
+            return false;
+        }
+        const unsigned char * sequence = data + pos + 4;
+
+        /* start sequence, also inside a frame to resynchronise after lost bytes */
+        if (memcmp(sequence, versionSequence, 4) == 0) {
+            if (m_inFrame) {
+                m_droppedFrames++;
+            }
+            m_buffer.consume(pos);
+            m_inFrame = true;
+            m_scan = sequenceLen;
+            m_escapes.clear();
+            continue;
+        }
+
+        /* escape sequences are 4 byte aligned to the frame start, ignore others */
+        if (!m_inFrame || (pos % 4) != 0) {
+            m_scan = pos + 1;
+            continue;
+        }
+
+        if (pos + 8 > m_maxFrameLen) {
+            resync();
+            continue;
+        }
+
+        if (memcmp(sequence, escapeSequence, 4) == 0) {
+            /*
+             * escaped escape sequence in payload, unless a start sequence follows,
+             * then the frame was truncated right after an escape sequence
+             */
+            if (pos + 12 > len) {
+                m_scan = pos;
+                return false;
+            }
+            if (memcmp(sequence + 4, versionSequence, 4) == 0) {
+                m_scan = pos + 4;
+                continue;
+            }
+            /* the second escape sequence might also start an unaligned start sequence */
+            m_escapes.push_back(pos);
+            m_scan = pos + 5;
+            continue;
+        }
+
+        if (sequence[0] != 0x1a || sequence[1] > 3) {
+            /* unknown escape sequence or invalid number of padding bytes */
+            resync();
+            continue;
+        }
+
+        /* end sequence, the CRC covers the escaped frame up to the padding count */
+        size_t frameLen = pos + 8;
+        if (m_verifyCrc && crc16(data, pos + 6) != (data[pos + 6] | (data[pos + 7] << 8))) {
+            /* maybe a truncated frame with the next one inside, search from here */
+            m_crcErrors++;
+            resync();
+            continue;
+        }
+
+        /* remove escaped escape sequences in place */
+        size_t out = frameLen;
+        if (!m_escapes.empty()) {
+            out = m_escapes[0] + 4;
+            for (size_t i = 0; i < m_escapes.size(); i++) {
+                size_t start = m_escapes[i] + 8;
+                size_t end = (i + 1 < m_escapes.size()) ? m_escapes[i + 1] + 4 : frameLen;
+                memmove(data + out, data + start, end - start);
+                out += end - start;
+            }
+        }
+
+        frame.data = data;
+        frame.len = out;
+        frame.offset = m_buffer.consumed();
+        m_consume = frameLen;
+        m_inFrame = false;
+        m_scan = 0;
+        m_escapes.clear();
+        return true;
+    }
+}
+
+void SmlFramer::reset()
+{
+    m_buffer.consume(m_buffer.readable());
+    m_inFrame = false;
+    m_scan = 0;
+    m_consume = 0;
+    m_escapes.clear();
+}
+
+void SmlFramer::resync()
+{
+    m_droppedFrames++;
+    m_inFrame = false;
+    m_scan = 1;
+    m_escapes.clear();
+}
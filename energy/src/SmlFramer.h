@@ -0,0 +1,128 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* project internal includes */
+#include "RingBuffer.h"
+
+/** view of a complete SML transport frame */
+struct SmlFrame
+{
+    /** frame, starting with the start sequence and ending with the end sequence */
+    unsigned char * data;
+
+    /** length of frame */
+    size_t len;
+
+    /** stream position of the first byte, counting all bytes committed */
+    uint64_t offset;
+};
+
+/**
+ * Incremental SML transport (version 1) framer.
+ *
+ * Received bytes are read directly into a ring buffer. The escape
+ * sequences are searched with SIMD (SSE2, NEON) or memchr. Complete frames
+ * are unescaped in place and handed out as views into the buffer, without
+ * copying them. The frame CRC is verified before unescaping. After invalid
+ * escape sequences, CRC errors, truncated or too long frames the framer
+ * resynchronises at the next start sequence.
+ */
+class SmlFramer
+{
+public:
+    /**
+     * @param[in] bufferSize size of the receive buffer
+     * @param[in] maxFrameLen frames exceeding this length are dropped
+     * @throw std::system_error if the buffer can't be created
+     */
+    explicit SmlFramer(size_t bufferSize = 65536, size_t maxFrameLen = 16384);
+
+    /** start of the free region to read into */
+    unsigned char * writePtr() { return m_buffer.writePtr(); }
+
+    /** size of the free region */
+    size_t writable() const { return m_buffer.writable(); }
+
+    /**
+     * mark bytes read into writePtr() as received
+     *
+     * @param[in] len number of bytes
+     */
+    void commit(size_t len) { m_buffer.commit(len); }
+
+    /**
+     * get the next complete frame
+     *
+     * The frame stays valid until the next call of next().
+     * Escaped escape sequences in the payload are already removed.
+     *
+     * @param[out] frame next frame
+     * @return false if no complete frame is available yet
+     */
+    bool next(SmlFrame & frame);
+
+    /** drop all received bytes and search for the next start sequence */
+    void reset();
+
+    /**
+     * enable or disable the frame CRC check, it is enabled by default
+     *
+     * @param[in] verify check the CRC
+     */
+    void setVerifyCrc(bool verify) { m_verifyCrc = verify; }
+
+    /** number of frames dropped because of invalid escape sequences, CRC or length */
+    uint64_t droppedFrames() const { return m_droppedFrames; }
+
+    /** number of frames dropped because of a CRC error */
+    uint64_t crcErrors() const { return m_crcErrors; }
+
+private:
+    /** drop the current frame and search the next start sequence after its start */
+    void resync();
+
+    /** receive buffer */
+    RingBuffer m_buffer;
+
+    /** maximum frame length */
+    size_t m_maxFrameLen;
+
+    /** check the frame CRC */
+    bool m_verifyCrc;
+
+    /** a frame starts at the begin of the readable region */
+    bool m_inFrame;
+
+    /** offset in the readable region to continue scanning at */
+    size_t m_scan;
+
+    /** bytes to consume on the next call of next() */
+    size_t m_consume;
+
+    /** offsets of escaped escape sequences in the current frame */
+    std::vector<size_t> m_escapes;
+
+    /** number of dropped frames */
+    uint64_t m_droppedFrames;
+
+    /** number of frames with CRC errors */
+    uint64_t m_crcErrors;
+};
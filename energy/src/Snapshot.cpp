@@ -0,0 +1,202 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#include "Snapshot.h"
+
+/* C includes */
+#include <math.h>
+
+/* C++ includes */
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+/* project internal includes */
+#include "Format.h"
+
+/** CBOR major types */
+static const unsigned char cborTypeUnsigned = 0;
+static const unsigned char cborTypeNegative = 1;
+static const unsigned char cborTypeText = 3;
+
+/** CBOR start of an indefinite length map, and its end */
+static const char cborMapStart = '\xbf';
+static const char cborBreak = '\xff';
+
+/** CBOR float64 head */
+static const char cborFloat64 = '\xfb';
+
+/** largest integer a double holds exactly */
+static const double maxExactInteger = 9007199254740992.0;
+
+/**
+ * JSON string with quotes
+ *
+ * @param[in] text text, UTF-8
+ * @return escaped text in quotes
+ */
+static std::string jsonString(const std::string & text)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string s = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            s += '\\';
+            s += static_cast<char>(c);
+        } else if (c < 0x20) {
+            s += "\\u00";
+            s += hex[c >> 4];
+            s += hex[c & 0x0f];
+        } else {
+            s += static_cast<char>(c);
+        }
+    }
+    return s + "\"";
+}
+
+SnapshotEncoder::SnapshotEncoder(SnapshotFormat format, const std::vector<std::string> & names) :
+    m_format(format),
+    m_keys(),
+    m_buffer(),
+    m_count(0)
+{
+    /* keys are encoded once, a value appends its key as is */
+    for (const std::string & name : names) {
+        if (m_format == SnapshotFormat::Json) {
+            m_keys.push_back(jsonString(name) + ":");
+        } else {
+            m_buffer.clear();
+            cborText(name);
+            m_keys.push_back(m_buffer);
+        }
+    }
+    m_buffer.clear();
+    m_buffer.reserve(256);
+}
+
+void SnapshotEncoder::begin(int64_t time)
+{
+    m_buffer.clear();
+    m_count = 0;
+    if (m_format == SnapshotFormat::Json) {
+        m_buffer += "{\"time\":";
+        decimal(time < 0 ? 0 : static_cast<uint64_t>(time));
+        m_buffer += ",\"values\":{";
+    } else {
+        /* the outer map and the values are open ended, the number of values is not known yet */
+        m_buffer += cborMapStart;
+        cborText("time");
+        cborHead(cborTypeUnsigned, time < 0 ? 0 : static_cast<uint64_t>(time));
+        cborText("values");
+        m_buffer += cborMapStart;
+    }
+}
+
+void SnapshotEncoder::add(std::size_t index, double value, int precision)
+{
+    if (m_format == SnapshotFormat::Json) {
+        char formatted[32];
+        int len = formatFixed(formatted, sizeof(formatted), value, precision);
+        if (len < 0) {
+            return;
+        }
+        if (m_count > 0) {
+            m_buffer += ',';
+        }
+        m_buffer += m_keys[index];
+        m_buffer.append(formatted, len);
+    } else {
+        m_buffer += m_keys[index];
+        double scale = pow(10, precision);
+        double rounded = round(value * scale) / scale;
+        if (rounded == floor(rounded) && fabs(rounded) < maxExactInteger) {
+            if (rounded >= 0) {
+                cborHead(cborTypeUnsigned, static_cast<uint64_t>(rounded));
+            } else {
+                cborHead(cborTypeNegative, static_cast<uint64_t>(-rounded) - 1);
+            }
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &rounded, sizeof(bits));
+            m_buffer += cborFloat64;
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                m_buffer += static_cast<char>(bits >> shift);
+            }
+        }
+    }
+    m_count++;
+}
+
+std::string_view SnapshotEncoder::finish(bool hasMeterTime, uint32_t meterTime)
+{
+    if (m_format == SnapshotFormat::Json) {
+        m_buffer += '}';
+        if (hasMeterTime) {
+            m_buffer += ",\"meter_time\":";
+            decimal(meterTime);
+        }
+        m_buffer += '}';
+    } else {
+        m_buffer += cborBreak;
+        if (hasMeterTime) {
+            cborText("meter_time");
+            cborHead(cborTypeUnsigned, meterTime);
+        }
+        m_buffer += cborBreak;
+    }
+    return m_buffer;
+}
+
+SnapshotFormat SnapshotEncoder::parseFormat(const std::string & text)
+{
+    if (text == "none") {
+        return SnapshotFormat::None;
+    }
+    if (text == "json") {
+        return SnapshotFormat::Json;
+    }
+    if (text == "cbor") {
+        return SnapshotFormat::Cbor;
+    }
+    throw std::invalid_argument("snapshot: " + text + " is not none, json or cbor");
+}
+
+void SnapshotEncoder::cborHead(unsigned char major, uint64_t argument)
+{
+    /* shortest form: in the head, or 1, 2, 4 or 8 following bytes */
+    major <<= 5;
+    if (argument < 24) {
+        m_buffer += static_cast<char>(major | argument);
+        return;
+    }
+    int bytes = argument <= 0xff ? 1 : argument <= 0xffff ? 2 : argument <= 0xffffffff ? 4 : 8;
+    m_buffer += static_cast<char>(major | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        m_buffer += static_cast<char>(argument >> shift);
+    }
+}
+
+void SnapshotEncoder::cborText(std::string_view text)
+{
+    cborHead(cborTypeText, text.size());
+    m_buffer += text;
+}
+
+void SnapshotEncoder::decimal(uint64_t value)
+{
+    char formatted[24];
+    std::to_chars_result result = std::to_chars(formatted, formatted + sizeof(formatted), value);
+    m_buffer.append(formatted, result.ptr - formatted);
+}
@@ -0,0 +1,119 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** encoding of a snapshot */
+enum class SnapshotFormat
+{
+    /** no snapshot */
+    None,
+
+    /** compact JSON */
+    Json,
+
+    /** CBOR (RFC 8949) */
+    Cbor
+};
+
+/**
+ * Encodes all register values of one telegram into one message.
+ *
+ * The message is a map of
+ * - time: host time of the telegram in ms since the epoch,
+ * - values: map of control name to value, in the order of the telegram,
+ * - meter_time: actSensorTime of the meter in s (seconds index or UNIX
+ *   time, as sent), only if the meter sends it,
+ * e.g. {"time":1711800000997,"values":{"Total Energy":5217.6,"Current Power":721.6},"meter_time":32467}.
+ *
+ * JSON values have the precision of the register. In CBOR, values rounded
+ * to the precision are integers if whole, else float64. The buffer is
+ * reused, so encoding allocates only for the first telegrams.
+ */
+class SnapshotEncoder
+{
+public:
+    /**
+     * @param[in] format encoding, not None
+     * @param[in] names control name per register
+     */
+    SnapshotEncoder(SnapshotFormat format, const std::vector<std::string> & names);
+
+    /**
+     * start a message
+     *
+     * @param[in] time host time in ms since the epoch
+     */
+    void begin(int64_t time);
+
+    /**
+     * add a register value
+     *
+     * @param[in] index register index
+     * @param[in] value value
+     * @param[in] precision number of decimals
+     */
+    void add(std::size_t index, double value, int precision);
+
+    /**
+     * finish the message
+     *
+     * @param[in] hasMeterTime meterTime is set
+     * @param[in] meterTime actSensorTime of the meter
+     * @return message, valid until the next begin()
+     */
+    std::string_view finish(bool hasMeterTime, uint32_t meterTime);
+
+    /** number of values added since begin() */
+    std::size_t count() const { return m_count; }
+
+    /**
+     * parse a format name
+     *
+     * @param[in] text none, json or cbor
+     * @return format
+     * @throw std::invalid_argument if text is unknown
+     */
+    static SnapshotFormat parseFormat(const std::string & text);
+
+private:
+    /** append a CBOR head (major type and argument) */
+    void cborHead(unsigned char major, uint64_t argument);
+
+    /** append a CBOR text string */
+    void cborText(std::string_view text);
+
+    /** append a decimal number */
+    void decimal(uint64_t value);
+
+    /** encoding */
+    SnapshotFormat m_format;
+
+    /** encoded key per register, including separators */
+    std::vector<std::string> m_keys;
+
+    /** message being encoded */
+    std::string m_buffer;
+
+    /** number of values added */
+    std::size_t m_count;
+};
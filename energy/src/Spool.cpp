@@ -0,0 +1,222 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "Spool.h"
+
+/* C includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+/* project internal includes */
+#include "Crc16.h"
+
+/** file magic */
+static const char spoolMagic[8] = { 'S', 'M', 'L', 'S', 'P', 'L', '0', '2' };
+
+/** size of the file header */
+static const std::size_t headerSize = 64;
+
+/** size of a record */
+static const std::size_t recordSize = 128;
+
+/** size of a record without its data */
+static const std::size_t recordHeaderSize = 24;
+
+const std::size_t Spool::maxData;
+
+struct Spool::Header
+{
+    /** spoolMagic */
+    char magic[8];
+
+    /** recordSize */
+    uint32_t recordSize;
+
+    /** reserved */
+    uint32_t reserved;
+
+    /** number of records */
+    uint64_t records;
+
+    /** records ever written */
+    uint64_t head;
+
+    /** records ever removed */
+    uint64_t tail;
+};
+
+struct Spool::Record
+{
+    /** CRC of the rest of the record, up to the end of the payload */
+    uint16_t crc;
+
+    /** length of the topic */
+    uint16_t topicLength;
+
+    /** length of the payload */
+    uint16_t payloadLength;
+
+    /** reserved */
+    uint16_t reserved;
+
+    /** index of the record (head when written), a record left from an earlier lap has another one */
+    uint64_t index;
+
+    /** microseconds since the epoch */
+    uint64_t time;
+
+    /** topic followed by payload */
+    char data[Spool::maxData];
+};
+
+/** CRC of a record */
+static uint16_t recordCrc(const unsigned char * record, std::size_t dataLength)
+{
+    return crc16(record + 2, recordHeaderSize - 2 + dataLength);
+}
+
+Spool::Spool(const std::string & file, std::size_t records) :
+    m_data(nullptr),
+    m_size(headerSize + records * recordSize),
+    m_records(records),
+    m_count(0),
+    m_dropped(0)
+{
+    static_assert(sizeof(Header) <= headerSize, "Spool::Header too large");
+    static_assert(sizeof(Record) == recordSize, "Spool::Record has wrong size");
+    static_assert(offsetof(Record, data) == recordHeaderSize, "Spool::Record has wrong header size");
+
+    if (records == 0) {
+        throw std::invalid_argument("Spool: number of records must not be 0");
+    }
+
+    int fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + file);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + file);
+    }
+    bool valid = (static_cast<std::size_t>(st.st_size) == m_size);
+    if (!valid && ftruncate(fd, m_size) < 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "ftruncate " + file);
+    }
+    void * area = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "mmap " + file);
+    }
+    close(fd);
+    m_data = static_cast<unsigned char *>(area);
+
+    /* start empty if the file is new or doesn't match */
+    Header * header = reinterpret_cast<Header *>(m_data);
+    valid = valid &&
+        (memcmp(header->magic, spoolMagic, sizeof(spoolMagic)) == 0) &&
+        (header->recordSize == recordSize) &&
+        (header->records == m_records) &&
+        (header->tail <= header->head) &&
+        (header->head - header->tail <= m_records);
+    if (!valid) {
+        memset(header, 0, headerSize);
+        memcpy(header->magic, spoolMagic, sizeof(spoolMagic));
+        header->recordSize = recordSize;
+        header->records = m_records;
+    }
+    m_count.store(header->head - header->tail, std::memory_order_relaxed);
+}
+
+Spool::~Spool()
+{
+    msync(m_data, m_size, MS_ASYNC);
+    munmap(m_data, m_size);
+}
+
+bool Spool::push(uint64_t time, std::string_view topic, std::string_view payload)
+{
+    if (topic.size() + payload.size() > maxData) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Header * header = reinterpret_cast<Header *>(m_data);
+    if (header->head - header->tail >= m_records) {
+        header->tail++;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* fill the record first, it becomes visible by advancing head */
+    Record & r = record(header->head);
+    r.topicLength = static_cast<uint16_t>(topic.size());
+    r.payloadLength = static_cast<uint16_t>(payload.size());
+    r.reserved = 0;
+    r.index = header->head;
+    r.time = time;
+    memcpy(r.data, topic.data(), topic.size());
+    memcpy(r.data + topic.size(), payload.data(), payload.size());
+    r.crc = recordCrc(reinterpret_cast<unsigned char *>(&r), topic.size() + payload.size());
+    header->head++;
+    m_count.store(header->head - header->tail, std::memory_order_relaxed);
+    return true;
+}
+
+bool Spool::front(SpoolRecord & result)
+{
+    Header * header = reinterpret_cast<Header *>(m_data);
+    while (header->tail < header->head) {
+        Record & r = record(header->tail);
+        std::size_t length = r.topicLength + r.payloadLength;
+        if (length <= maxData && r.index == header->tail && r.crc == recordCrc(reinterpret_cast<unsigned char *>(&r), length)) {
+            result.time = r.time;
+            result.topic = std::string_view(r.data, r.topicLength);
+            result.payload = std::string_view(r.data + r.topicLength, r.payloadLength);
+            return true;
+        }
+
+        /* torn by a power loss, or left from an earlier lap if the header reached the disk first */
+        header->tail++;
+        m_count.store(header->head - header->tail, std::memory_order_relaxed);
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+void Spool::pop()
+{
+    Header * header = reinterpret_cast<Header *>(m_data);
+    if (header->tail < header->head) {
+        header->tail++;
+        m_count.store(header->head - header->tail, std::memory_order_relaxed);
+    }
+}
+
+Spool::Record & Spool::record(uint64_t index)
+{
+    return *reinterpret_cast<Record *>(m_data + headerSize + (index % m_records) * recordSize);
+}
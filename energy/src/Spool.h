@@ -0,0 +1,125 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/** reading stored in the spool */
+struct SpoolRecord
+{
+    /** time of the reading in microseconds since the epoch */
+    uint64_t time;
+
+    /** full topic, points into the spool */
+    std::string_view topic;
+
+    /** payload, points into the spool */
+    std::string_view payload;
+};
+
+/**
+ * Bounded offline spool of timestamped readings.
+ *
+ * The spool is a ring of fixed size records in a memory-mapped file, so
+ * memory and disk use are constant however long an outage lasts. When the
+ * ring is full, the oldest record is overwritten. A record is written
+ * completely before the head index is advanced, and carries its index and
+ * a CRC over both, so the spool survives a crash of the process, and
+ * records torn by a power loss or left from an earlier lap of the ring
+ * are skipped on read. Call push(), front() and pop() from one thread;
+ * size() and dropped() may be called from any thread.
+ *
+ * File format: 64 byte header (magic "SMLSPL02", record size, number of
+ * records, head, tail), then the records.
+ */
+class Spool
+{
+public:
+    /** maximum size of topic plus payload of a record */
+    static const std::size_t maxData = 104;
+
+    /**
+     * open or create a spool file
+     *
+     * An existing file with a different number of records is recreated.
+     *
+     * @param[in] file spool file
+     * @param[in] records number of records (128 bytes each)
+     * @throw std::invalid_argument if records is 0
+     * @throw std::system_error if the file can't be created or mapped
+     */
+    Spool(const std::string & file, std::size_t records);
+    virtual ~Spool();
+
+    Spool(const Spool &) = delete;
+    Spool & operator=(const Spool &) = delete;
+
+    /**
+     * append a reading, overwriting the oldest one if full
+     *
+     * @param[in] time time of the reading in microseconds since the epoch
+     * @param[in] topic full topic
+     * @param[in] payload payload
+     * @return false if topic and payload exceed maxData
+     */
+    bool push(uint64_t time, std::string_view topic, std::string_view payload);
+
+    /**
+     * get the oldest reading, skipping corrupt records
+     *
+     * @param[out] record reading, valid until the next push() or pop()
+     * @return false if the spool is empty
+     */
+    bool front(SpoolRecord & record);
+
+    /** remove the oldest reading */
+    void pop();
+
+    /** number of stored readings */
+    std::size_t size() const { return m_count.load(std::memory_order_relaxed); }
+
+    /** number of readings lost because the spool was full, too large or corrupt */
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    /** file header */
+    struct Header;
+
+    /** record */
+    struct Record;
+
+    /** record at an index */
+    Record & record(uint64_t index);
+
+    /** mapping of the whole file */
+    unsigned char * m_data;
+
+    /** size of the mapping */
+    std::size_t m_size;
+
+    /** number of records */
+    uint64_t m_records;
+
+    /** copy of head - tail, for size() */
+    std::atomic<uint64_t> m_count;
+
+    /** readings lost */
+    std::atomic<uint64_t> m_dropped;
+};
@@ -0,0 +1,175 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Bounded lock-free queue for one producer and one consumer thread.
+ *
+ * Every slot has a sequence number telling whether it is free or filled
+ * for a position, so the producer can also discard the oldest entry when
+ * the queue is full while the consumer is popping. Both claim an entry by
+ * compare-and-swap of the read position; the winner owns the slot until
+ * it releases the sequence.
+ *
+ * Values are swapped in and out, not copied: a T holding a buffer (e.g.
+ * std::string) passes its buffer around instead of allocating a new one.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+    /**
+     * @param[in] capacity number of entries, rounded up to a power of two
+     */
+    explicit SpscQueue(std::size_t capacity) :
+        m_slots(),
+        m_mask(0),
+        m_writePos(0),
+        m_readPos(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        m_slots.reset(new Slot[size]);
+        m_mask = size - 1;
+        for (std::size_t i = 0; i < size; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue & operator=(const SpscQueue &) = delete;
+
+    /**
+     * append a value (producer only)
+     *
+     * @param[in,out] value value, gets the contents of the free slot
+     * @return false if the queue is full
+     */
+    bool push(T & value)
+    {
+        uint64_t pos = m_writePos.load(std::memory_order_relaxed);
+        Slot & slot = m_slots[pos & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != pos) {
+            return false;
+        }
+        std::swap(slot.value, value);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        m_writePos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * take the oldest value (consumer, or producer to make room)
+     *
+     * @param[in,out] value gets the value, its contents go to the slot
+     * @return false if the queue is empty
+     */
+    bool pop(T & value)
+    {
+        uint64_t pos;
+        Slot * slot = claim(pos);
+        if (!slot) {
+            return false;
+        }
+        std::swap(slot->value, value);
+        slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * drop the oldest value (consumer, or producer to make room)
+     *
+     * @return false if the queue is empty
+     */
+    bool discard()
+    {
+        uint64_t pos;
+        Slot * slot = claim(pos);
+        if (!slot) {
+            return false;
+        }
+        slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** number of values, exact only when called by the producer or consumer */
+    std::size_t size() const
+    {
+        uint64_t read = m_readPos.load(std::memory_order_acquire);
+        uint64_t write = m_writePos.load(std::memory_order_acquire);
+        return write > read ? write - read : 0;
+    }
+
+    /** number of entries */
+    std::size_t capacity() const { return m_mask + 1; }
+
+private:
+    /** entry, one or more cache lines */
+    struct alignas(64) Slot
+    {
+        /** position the slot is free for, or position + 1 if filled */
+        std::atomic<uint64_t> sequence;
+
+        /** value */
+        T value;
+    };
+
+    /**
+     * claim the oldest filled slot
+     *
+     * @param[out] pos position of the slot
+     * @return slot, nullptr if the queue is empty
+     */
+    Slot * claim(uint64_t & pos)
+    {
+        pos = m_readPos.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot & slot = m_slots[pos & m_mask];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence < pos + 1) {
+                return nullptr;
+            }
+            if (sequence == pos + 1) {
+                if (m_readPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return &slot;
+                }
+            } else {
+                pos = m_readPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** slots */
+    std::unique_ptr<Slot[]> m_slots;
+
+    /** number of slots minus one */
+    std::size_t m_mask;
+
+    /** next position to write, written by the producer only */
+    alignas(64) std::atomic<uint64_t> m_writePos;
+
+    /** next position to read, claimed by compare-and-swap */
+    alignas(64) std::atomic<uint64_t> m_readPos;
+};
@@ -0,0 +1,473 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "TimeSeries.h"
+
+/* C includes */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+/** block magic */
+static const char blockMagic[4] = { 'S', 'M', 'T', 'S' };
+
+/** data bits of a block */
+static const uint32_t blockBits = (timeSeriesBlockSize - sizeof(TimeSeriesBlockHeader)) * 8;
+
+/** worst case size of a sample: 68 bits time, 2 + 5 + 6 + 64 bits value */
+static const uint32_t maxSampleBits = 145;
+
+/** ms per day */
+static const int64_t msPerDay = 24 * 60 * 60 * 1000LL;
+
+static_assert(sizeof(TimeSeriesBlockHeader) == 64, "TimeSeriesBlockHeader must have 64 bytes");
+
+/** create a directory and its parents */
+static void makeDirectories(const std::string & directory)
+{
+    for (std::size_t pos = 1; pos != std::string::npos; ) {
+        pos = directory.find('/', pos + 1);
+        std::string path = directory.substr(0, pos);
+        if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), "mkdir " + path);
+        }
+    }
+}
+
+/** file name of a day */
+static std::string dayFile(int64_t day)
+{
+    time_t t = static_cast<time_t>(day * 86400);
+    struct tm utc;
+    gmtime_r(&t, &utc);
+    char name[32];
+    strftime(name, sizeof(name), "%Y-%m-%d.sts", &utc);
+    return name;
+}
+
+/** reads bits MSB first */
+class BitReader
+{
+public:
+    BitReader(const unsigned char * data, uint32_t bits) : m_data(data), m_bits(bits), m_pos(0) {}
+
+    /** read count bits (1 to 64), false if past the end */
+    bool read(int count, uint64_t & value)
+    {
+        if (m_pos + count > m_bits) {
+            return false;
+        }
+        value = 0;
+        while (count > 0) {
+            int free = 8 - (m_pos & 7);
+            int n = std::min(free, count);
+            uint64_t chunk = (m_data[m_pos >> 3] >> (free - n)) & ((1U << n) - 1);
+            value = (value << n) | chunk;
+            m_pos += n;
+            count -= n;
+        }
+        return true;
+    }
+
+private:
+    const unsigned char * m_data;
+    uint32_t m_bits;
+    uint32_t m_pos;
+};
+
+TimeSeriesWriter::TimeSeriesWriter(const std::string & directory) :
+    m_directory(directory),
+    m_fd(-1),
+    m_day(-1),
+    m_blocks(0),
+    m_map(nullptr),
+    m_mapSize(0),
+    m_header(nullptr),
+    m_data(nullptr),
+    m_previousTime(INT64_MIN),
+    m_previousDelta(0),
+    m_previousValue(0),
+    m_leading(-1),
+    m_trailing(0)
+{
+    makeDirectories(m_directory);
+}
+
+TimeSeriesWriter::~TimeSeriesWriter()
+{
+    closeFile();
+}
+
+bool TimeSeriesWriter::append(int64_t time, double value)
+{
+    /* one file per UTC day */
+    int64_t day = (time >= 0 ? time : time - msPerDay + 1) / msPerDay;
+    if (day != m_day && !openFile(time)) {
+        return false;
+    }
+    if (time < m_previousTime) {
+        return false;
+    }
+    if (m_header->bits + maxSampleBits > blockBits && !startBlock()) {
+        return false;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if (m_header->count == 0) {
+        /* first sample of a block: raw time and value */
+        writeBits(static_cast<uint64_t>(time), 64);
+        writeBits(bits, 64);
+        m_previousDelta = 0;
+        m_leading = -1;
+        m_header->firstTime = time;
+        m_header->min = value;
+        m_header->max = value;
+    } else {
+        /* delta-of-delta of the timestamp */
+        int64_t delta = time - m_previousTime;
+        int64_t dod = delta - m_previousDelta;
+        if (dod == 0) {
+            writeBits(0, 1);
+        } else
+        if (dod >= -63 && dod <= 64) {
+            writeBits(0x2, 2);
+            writeBits(static_cast<uint64_t>(dod + 63), 7);
+        } else
+        if (dod >= -255 && dod <= 256) {
+            writeBits(0x6, 3);
+            writeBits(static_cast<uint64_t>(dod + 255), 9);
+        } else
+        if (dod >= -2047 && dod <= 2048) {
+            writeBits(0xe, 4);
+            writeBits(static_cast<uint64_t>(dod + 2047), 12);
+        } else {
+            writeBits(0xf, 4);
+            writeBits(static_cast<uint64_t>(dod), 64);
+        }
+        m_previousDelta = delta;
+
+        /* XOR with the previous value, only the meaningful bits */
+        uint64_t x = bits ^ m_previousValue;
+        if (x == 0) {
+            writeBits(0, 1);
+        } else {
+            int leading = std::min(__builtin_clzll(x), 31);
+            int trailing = __builtin_ctzll(x);
+            if (m_leading >= 0 && leading >= m_leading && trailing >= m_trailing) {
+                writeBits(0x2, 2);
+                writeBits(x >> m_trailing, 64 - m_leading - m_trailing);
+            } else {
+                int length = 64 - leading - trailing;
+                writeBits(0x3, 2);
+                writeBits(static_cast<uint64_t>(leading), 5);
+                writeBits(static_cast<uint64_t>(length - 1), 6);
+                writeBits(x >> trailing, length);
+                m_leading = leading;
+                m_trailing = trailing;
+            }
+        }
+        m_header->min = std::min(m_header->min, value);
+        m_header->max = std::max(m_header->max, value);
+    }
+    m_previousTime = time;
+    m_previousValue = bits;
+
+    /* the sample becomes visible to readers with the count */
+    m_header->lastTime = time;
+    m_header->count++;
+    return true;
+}
+
+bool TimeSeriesWriter::openFile(int64_t time)
+{
+    closeFile();
+    int64_t day = (time >= 0 ? time : time - msPerDay + 1) / msPerDay;
+    std::string file = m_directory + "/" + dayFile(day);
+    m_fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        std::cerr << "TimeSeriesWriter::openFile: can't open " << file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    /* continue after the last complete block */
+    struct stat st;
+    if (fstat(m_fd, &st) < 0) {
+        closeFile();
+        return false;
+    }
+    m_blocks = static_cast<uint64_t>(st.st_size) / timeSeriesBlockSize;
+    m_day = day;
+    if (!startBlock()) {
+        closeFile();
+        return false;
+    }
+    return true;
+}
+
+bool TimeSeriesWriter::startBlock()
+{
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+
+    /* the mapping must start at a page boundary */
+    off_t offset = static_cast<off_t>(m_blocks * timeSeriesBlockSize);
+    off_t page = static_cast<off_t>(sysconf(_SC_PAGESIZE));
+    off_t mapOffset = offset - offset % page;
+    if (ftruncate(m_fd, offset + timeSeriesBlockSize) < 0) {
+        std::cerr << "TimeSeriesWriter::startBlock: ftruncate failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_mapSize = static_cast<std::size_t>(offset - mapOffset) + timeSeriesBlockSize;
+    void * area = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, mapOffset);
+    if (area == MAP_FAILED) {
+        std::cerr << "TimeSeriesWriter::startBlock: mmap failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_map = static_cast<unsigned char *>(area);
+    unsigned char * block = m_map + (offset - mapOffset);
+    m_blocks++;
+
+    m_header = reinterpret_cast<TimeSeriesBlockHeader *>(block);
+    m_data = block + sizeof(TimeSeriesBlockHeader);
+    memset(block, 0, timeSeriesBlockSize);
+    memcpy(m_header->magic, blockMagic, sizeof(blockMagic));
+    m_header->version = 1;
+    m_header->headerSize = sizeof(TimeSeriesBlockHeader);
+    return true;
+}
+
+void TimeSeriesWriter::closeFile()
+{
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_header = nullptr;
+    m_data = nullptr;
+    m_day = -1;
+}
+
+void TimeSeriesWriter::writeBits(uint64_t value, int count)
+{
+    uint32_t pos = m_header->bits;
+    while (count > 0) {
+        int free = 8 - (pos & 7);
+        int n = std::min(free, count);
+        uint64_t chunk = (value >> (count - n)) & ((1U << n) - 1);
+        m_data[pos >> 3] |= static_cast<unsigned char>(chunk << (free - n));
+        pos += n;
+        count -= n;
+    }
+    m_header->bits = pos;
+}
+
+TimeSeriesReader::TimeSeriesReader(const std::string & directory) :
+    m_directory(directory)
+{
+}
+
+std::vector<std::string> TimeSeriesReader::files() const
+{
+    std::vector<std::string> files;
+    DIR * dir = opendir(m_directory.c_str());
+    if (!dir) {
+        return files;
+    }
+    while (struct dirent * entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() == 14 && name.compare(10, 4, ".sts") == 0) {
+            files.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool TimeSeriesReader::scan(int64_t from, int64_t to, Callback callback, BlockFilter filter) const
+{
+    /* days of the range, limited to the years 1970 to 9999 */
+    static const int64_t maxDay = 2932896;
+    std::string first = dayFile(std::min(std::max<int64_t>(from / msPerDay, 0), maxDay));
+    std::string last = dayFile(std::min(std::max<int64_t>(to / msPerDay, 0), maxDay));
+    for (const std::string & name : files()) {
+        if (name < first || name > last) {
+            continue;
+        }
+
+        std::string file = m_directory + "/" + name;
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return false;
+        }
+        std::size_t size = static_cast<std::size_t>(st.st_size) - static_cast<std::size_t>(st.st_size) % timeSeriesBlockSize;
+        if (size == 0) {
+            close(fd);
+            continue;
+        }
+        void * area = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (area == MAP_FAILED) {
+            return false;
+        }
+        const unsigned char * data = static_cast<const unsigned char *>(area);
+
+        bool stop = false;
+        for (std::size_t offset = 0; offset < size && !stop; offset += timeSeriesBlockSize) {
+            const TimeSeriesBlockHeader * header = reinterpret_cast<const TimeSeriesBlockHeader *>(data + offset);
+            if (header->count == 0 || header->lastTime < from || header->firstTime > to) {
+                continue;
+            }
+            if (filter && !filter(*header)) {
+                continue;
+            }
+            decodeBlock(data + offset, [&](const TimeSeriesSample & sample) {
+                if (sample.time > to) {
+                    stop = true;
+                    return false;
+                }
+                if (sample.time >= from && !callback(sample)) {
+                    stop = true;
+                    return false;
+                }
+                return true;
+            });
+        }
+        munmap(area, size);
+        if (stop) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool TimeSeriesReader::decodeBlock(const unsigned char * block, Callback callback)
+{
+    const TimeSeriesBlockHeader * header = reinterpret_cast<const TimeSeriesBlockHeader *>(block);
+    if (memcmp(header->magic, blockMagic, sizeof(blockMagic)) != 0 || header->version != 1 || header->bits > blockBits) {
+        return false;
+    }
+    BitReader reader(block + header->headerSize, header->bits);
+
+    TimeSeriesSample sample;
+    uint64_t time;
+    uint64_t bits;
+    if (header->count == 0 || !reader.read(64, time) || !reader.read(64, bits)) {
+        return header->count == 0;
+    }
+    sample.time = static_cast<int64_t>(time);
+    memcpy(&sample.value, &bits, sizeof(bits));
+    if (!callback(sample)) {
+        return false;
+    }
+
+    int64_t delta = 0;
+    int leading = 0;
+    int trailing = 0;
+    for (uint32_t i = 1; i < header->count; i++) {
+        /* timestamp: 0, 10, 110, 1110 or 1111 prefix */
+        uint64_t bit;
+        uint64_t dod;
+        int prefix = 0;
+        while (prefix < 4 && reader.read(1, bit) && bit) {
+            prefix++;
+        }
+        static const int dodBits[] = { 0, 7, 9, 12, 64 };
+        static const int64_t dodBias[] = { 0, 63, 255, 2047, 0 };
+        if (prefix == 0) {
+            dod = 0;
+        } else
+        if (!reader.read(dodBits[prefix], dod)) {
+            return false;
+        }
+        delta += static_cast<int64_t>(dod) - dodBias[prefix];
+        sample.time += delta;
+
+        /* value: 0 unchanged, 10 previous window, 11 new window */
+        if (!reader.read(1, bit)) {
+            return false;
+        }
+        if (bit) {
+            uint64_t newWindow;
+            uint64_t x;
+            if (!reader.read(1, newWindow)) {
+                return false;
+            }
+            if (newWindow) {
+                uint64_t l;
+                uint64_t length;
+                if (!reader.read(5, l) || !reader.read(6, length)) {
+                    return false;
+                }
+                leading = static_cast<int>(l);
+                trailing = 64 - leading - static_cast<int>(length + 1);
+            }
+            if (!reader.read(64 - leading - trailing, x)) {
+                return false;
+            }
+            bits ^= x << trailing;
+            memcpy(&sample.value, &bits, sizeof(bits));
+        }
+        if (!callback(sample)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TimeSeriesStore::TimeSeriesStore(const std::string & directory) :
+    m_directory(directory),
+    m_channels()
+{
+    makeDirectories(m_directory);
+}
+
+TimeSeriesWriter & TimeSeriesStore::channel(const std::string & channel)
+{
+    std::unique_ptr<TimeSeriesWriter> & writer = m_channels[channel];
+    if (!writer) {
+        writer.reset(new TimeSeriesWriter(m_directory + "/" + channel));
+    }
+    return *writer;
+}
+
+std::string TimeSeriesStore::channelName(const std::string & meter, const std::string & obis)
+{
+    std::string name = meter + "/" + obis;
+    std::replace(name.begin() + meter.size() + 1, name.end(), ':', '_');
+    std::replace(name.begin() + meter.size() + 1, name.end(), '*', '_');
+    return name;
+}
@@ -0,0 +1,247 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Compressed time series files.
+ *
+ * A channel (one register of one meter) is a directory with one file per
+ * UTC day (YYYY-MM-DD.sts). A file is a sequence of 4 KiB blocks, each
+ * with a 64 byte header (sample count, time range, min and max) and
+ * Gorilla compressed samples: millisecond timestamps as delta-of-delta,
+ * values as XOR of the previous value's bits. At 1 Hz a slowly changing
+ * counter takes 1 to 2 bytes per sample, a noisy decimal value up to 8.
+ *
+ * Blocks are only appended. The block being written is memory-mapped and
+ * its header is updated after every sample, so a crash loses nothing that
+ * was appended before; a reopened channel continues in a new block.
+ */
+
+/** size of a block in bytes */
+static const std::size_t timeSeriesBlockSize = 4096;
+
+/** header of a block */
+struct TimeSeriesBlockHeader
+{
+    /** "SMTS" */
+    char magic[4];
+
+    /** format version, 1 */
+    uint16_t version;
+
+    /** header size, 64 */
+    uint16_t headerSize;
+
+    /** number of samples */
+    uint32_t count;
+
+    /** number of used data bits */
+    uint32_t bits;
+
+    /** time of the first sample in ms since the epoch */
+    int64_t firstTime;
+
+    /** time of the last sample in ms since the epoch */
+    int64_t lastTime;
+
+    /** smallest value */
+    double min;
+
+    /** largest value */
+    double max;
+
+    /** reserved, 0 */
+    uint8_t reserved[16];
+};
+
+/** sample */
+struct TimeSeriesSample
+{
+    /** ms since the epoch */
+    int64_t time;
+
+    /** value */
+    double value;
+};
+
+/** appends samples to a channel */
+class TimeSeriesWriter
+{
+public:
+    /**
+     * @param[in] directory channel directory, created if missing
+     * @throw std::system_error if the directory can't be created
+     */
+    explicit TimeSeriesWriter(const std::string & directory);
+    virtual ~TimeSeriesWriter();
+
+    TimeSeriesWriter(const TimeSeriesWriter &) = delete;
+    TimeSeriesWriter & operator=(const TimeSeriesWriter &) = delete;
+
+    /**
+     * append a sample, times must not decrease
+     *
+     * @param[in] time ms since the epoch
+     * @param[in] value value
+     * @return false if the file can't be written or time went backwards
+     */
+    bool append(int64_t time, double value);
+
+private:
+    /** open the file of the day of time and start a new block */
+    bool openFile(int64_t time);
+
+    /** start a new block at the end of the file */
+    bool startBlock();
+
+    /** close the file */
+    void closeFile();
+
+    /**
+     * write bits to the current block
+     *
+     * @param[in] value bits, right aligned
+     * @param[in] count number of bits, 1 to 64
+     */
+    void writeBits(uint64_t value, int count);
+
+    /** channel directory */
+    std::string m_directory;
+
+    /** file descriptor of the current file, -1 if none */
+    int m_fd;
+
+    /** day of the current file, days since the epoch */
+    int64_t m_day;
+
+    /** number of blocks in the current file */
+    uint64_t m_blocks;
+
+    /** mapping of the current block */
+    unsigned char * m_map;
+
+    /** size of the mapping */
+    std::size_t m_mapSize;
+
+    /** header of the current block, inside m_map */
+    TimeSeriesBlockHeader * m_header;
+
+    /** data of the current block, inside m_map */
+    unsigned char * m_data;
+
+    /** encoder state, see TimeSeries.cpp */
+    int64_t m_previousTime;
+    int64_t m_previousDelta;
+    uint64_t m_previousValue;
+    int m_leading;
+    int m_trailing;
+};
+
+/**
+ * Reads samples of a channel.
+ */
+class TimeSeriesReader
+{
+public:
+    /** called per sample, return false to stop */
+    typedef std::function<bool(const TimeSeriesSample & sample)> Callback;
+
+    /** called per block with its header, return false to skip the block */
+    typedef std::function<bool(const TimeSeriesBlockHeader & header)> BlockFilter;
+
+    /**
+     * @param[in] directory channel directory
+     */
+    explicit TimeSeriesReader(const std::string & directory);
+
+    /**
+     * read the samples in a time range, in order
+     *
+     * Files and blocks outside the range are skipped without decoding.
+     *
+     * @param[in] from first time in ms since the epoch
+     * @param[in] to last time in ms since the epoch
+     * @param[in] callback called per sample
+     * @param[in] filter called per block in the range, nullptr to read all
+     * @return false if a file could not be read
+     */
+    bool scan(int64_t from, int64_t to, Callback callback, BlockFilter filter = nullptr) const;
+
+    /** files of the channel, sorted by day */
+    std::vector<std::string> files() const;
+
+    /**
+     * decode the samples of a block
+     *
+     * @param[in] block block of timeSeriesBlockSize bytes
+     * @param[in] callback called per sample
+     * @return false if the block is invalid or callback returned false
+     */
+    static bool decodeBlock(const unsigned char * block, Callback callback);
+
+private:
+    /** channel directory */
+    std::string m_directory;
+};
+
+/**
+ * Store of all channels below a directory.
+ */
+class TimeSeriesStore
+{
+public:
+    /**
+     * @param[in] directory store directory, created if missing
+     * @throw std::system_error if the directory can't be created
+     */
+    explicit TimeSeriesStore(const std::string & directory);
+
+    /**
+     * get the writer of a channel, created on first use
+     *
+     * @param[in] channel channel name (e.g. vzir0/1-0_1.8.0_255)
+     * @return writer, valid for the lifetime of the store
+     * @throw std::system_error if the channel directory can't be created
+     */
+    TimeSeriesWriter & channel(const std::string & channel);
+
+    /**
+     * channel name of a meter register
+     *
+     * @param[in] meter meter name (e.g. the device name vzir0)
+     * @param[in] obis OBIS code as string (e.g. 1-0:1.8.0*255)
+     * @return channel name (e.g. vzir0/1-0_1.8.0_255)
+     */
+    static std::string channelName(const std::string & meter, const std::string & obis);
+
+    /** store directory */
+    const std::string & directory() const { return m_directory; }
+
+private:
+    /** store directory */
+    std::string m_directory;
+
+    /** writers per channel */
+    std::map<std::string, std::unique_ptr<TimeSeriesWriter>> m_channels;
+};
@@ -0,0 +1,117 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#include "TopicCache.h"
+
+/* C++ includes */
+#include <stdexcept>
+
+const TopicCache::Handle TopicCache::npos;
+
+TopicCache::TopicCache(std::size_t capacity) :
+    m_slots(),
+    m_mask(0),
+    m_size(0),
+    m_insertMutex()
+{
+    std::size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    m_slots.reset(new Slot[slots]);
+    m_mask = slots - 1;
+    for (std::size_t i = 0; i < slots; ++i) {
+        m_slots[i].key.store(0, std::memory_order_relaxed);
+        m_slots[i].payloadHash.store(0, std::memory_order_relaxed);
+        m_slots[i].version.store(0, std::memory_order_relaxed);
+    }
+}
+
+TopicCache::~TopicCache()
+{
+}
+
+TopicCache::Handle TopicCache::insert(std::string_view topic)
+{
+    Handle handle = find(topic);
+    if (handle != npos) {
+        return handle;
+    }
+
+    std::lock_guard<std::mutex> lock(m_insertMutex);
+
+    /* keep one slot free, so probing for unknown topics terminates */
+    if (m_size.load(std::memory_order_relaxed) >= m_mask) {
+        throw std::length_error("TopicCache::insert: table full");
+    }
+
+    uint64_t key = hash(topic);
+    for (std::size_t i = key & m_mask; ; i = (i + 1) & m_mask) {
+        Slot & slot = m_slots[i];
+        uint64_t slotKey = slot.key.load(std::memory_order_acquire);
+        if (slotKey == 0) {
+            slot.topic.assign(topic.data(), topic.size());
+            slot.key.store(key, std::memory_order_release);
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            return i;
+        }
+
+        /* inserted by another thread since find() */
+        if (slotKey == key && slot.topic == topic) {
+            return i;
+        }
+    }
+}
+
+TopicCache::Handle TopicCache::find(std::string_view topic) const
+{
+    uint64_t key = hash(topic);
+    for (std::size_t i = key & m_mask; ; i = (i + 1) & m_mask) {
+        const Slot & slot = m_slots[i];
+        uint64_t slotKey = slot.key.load(std::memory_order_acquire);
+        if (slotKey == 0) {
+            return npos;
+        }
+        if (slotKey == key && slot.topic == topic) {
+            return i;
+        }
+    }
+}
+
+bool TopicCache::update(Handle handle, std::string_view payload)
+{
+    Slot & slot = m_slots[handle];
+    uint64_t payloadHash = hash(payload);
+
+    /* cheap check first, to keep the cache line shared while nothing changes */
+    if (slot.payloadHash.load(std::memory_order_relaxed) == payloadHash) {
+        return false;
+    }
+    if (slot.payloadHash.exchange(payloadHash, std::memory_order_relaxed) == payloadHash) {
+        return false;
+    }
+    slot.version.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t TopicCache::hash(std::string_view data)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : data) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h != 0 ? h : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+#pragma once
+
+/* C++ includes */
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * Fixed capacity topic table for change detection.
+ *
+ * Topics live in an open addressing table of cache line sized slots. A slot
+ * keeps the hash of the last payload and a version counter instead of the
+ * payload itself, so checking and recording a change is a single atomic
+ * exchange. Lookups and updates are lock-free; only inserting a new topic
+ * takes a mutex. Slots are never removed, a handle stays valid for the
+ * lifetime of the cache.
+ */
+class TopicCache
+{
+public:
+    /** handle of a topic, the slot index */
+    typedef std::size_t Handle;
+
+    /** returned by find() for unknown topics */
+    static const Handle npos = static_cast<Handle>(-1);
+
+    /**
+     * @param[in] capacity number of slots, rounded up to a power of two
+     */
+    explicit TopicCache(std::size_t capacity = 1024);
+    virtual ~TopicCache();
+
+    TopicCache(const TopicCache &) = delete;
+    TopicCache & operator=(const TopicCache &) = delete;
+
+    /**
+     * find or insert a topic
+     *
+     * @param[in] topic full topic
+     * @return handle
+     * @throw std::length_error if the table is full
+     */
+    Handle insert(std::string_view topic);
+
+    /**
+     * find a topic, lock-free
+     *
+     * @param[in] topic full topic
+     * @return handle, or npos if unknown
+     */
+    Handle find(std::string_view topic) const;
+
+    /**
+     * record a payload, lock-free
+     *
+     * @param[in] handle topic handle
+     * @param[in] payload payload
+     * @return true if the payload differs from the last one, or is the first
+     */
+    bool update(Handle handle, std::string_view payload);
+
+    /**
+     * forget the last payload, so the next update() reports a change
+     *
+     * @param[in] handle topic handle
+     */
+    void invalidate(Handle handle) { m_slots[handle].payloadHash.store(0, std::memory_order_relaxed); }
+
+    /** full topic of a handle */
+    const std::string & topic(Handle handle) const { return m_slots[handle].topic; }
+
+    /** number of changes recorded for a handle */
+    uint32_t version(Handle handle) const { return m_slots[handle].version.load(std::memory_order_relaxed); }
+
+    /** number of topics */
+    std::size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    /** number of slots, all handles are smaller */
+    std::size_t capacity() const { return m_mask + 1; }
+
+private:
+    /** table slot, one cache line */
+    struct alignas(64) Slot
+    {
+        /** topic hash, 0 if the slot is free; published after topic */
+        std::atomic<uint64_t> key;
+
+        /** hash of the last payload, 0 if none */
+        std::atomic<uint64_t> payloadHash;
+
+        /** number of changes */
+        std::atomic<uint32_t> version;
+
+        /** full topic, immutable once key is set */
+        std::string topic;
+    };
+
+    /** hash, never 0 */
+    static uint64_t hash(std::string_view data);
+
+    /** slots */
+    std::unique_ptr<Slot[]> m_slots;
+
+    /** number of slots minus one */
+    std::size_t m_mask;
+
+    /** number of used slots */
+    std::atomic<std::size_t> m_size;
+
+    /** serializes inserts */
+    std::mutex m_insertMutex;
+};
@@ -25,6 +25,8 @@
  */
 
 /* C includes */
+#include <mosquitto.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #ifdef WITH_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -38,24 +40,138 @@
 #include <cstdint>
 #include <iomanip>
 #include <iostream>
-#include <mosquittopp.h>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <thread>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 /* project internal includes */
+#include "Capture.h"
+#ifdef WITH_COROUTINES
+#include "Coroutine.h"
+#endif
+#include "EventLoop.h"
+#include "Latency.h"
 #include "SML.h"
 #include "MqttClient.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+#include "ObisMap.h"
+#include "PublishQueue.h"
+#include "Replay.h"
+#include "Snapshot.h"
+#include "Spool.h"
+#include "TimeSeries.h"
+
+/** interval of verbose statistics */
+static const std::chrono::seconds statsInterval(60);
+
+/** configuration of one meter */
+struct MeterConfig
+{
+    /** device to read sml messages from */
+    std::string device;
+
+    /** MQTT topic to publish to */
+    std::string topic;
+
+    /** OBIS registers to publish */
+    ObisMap registers;
+
+    /** drop frames and messages with wrong CRC */
+    bool verifyCrc;
+
+    /** encoding of the snapshot per telegram */
+    SnapshotFormat snapshot;
 
-/** abort the main loop */
-std::atomic<bool> abortLoop;
+    /** publish registers only in the snapshot */
+    bool snapshotOnly;
+};
+
+#ifdef WITH_COROUTINES
+/**
+ * read a meter until its device fails
+ *
+ * Reading, framing, decoding and publishing run in sequence in
+ * sml.onReadable(), the coroutine waits for the device in between.
+ *
+ * @param[in] loop event loop
+ * @param[in] sml meter with an open device
+ * @param[in] failed called when the device failed
+ * @throw std::system_error if the device can't be watched
+ */
+static Task readMeter(EventLoop & loop, SML & sml, EventLoop::Callback failed)
+{
+    FdWatcher device(loop, sml.fd(), EPOLLIN);
+    for (;;) {
+        uint32_t events = co_await device;
+        if (!sml.onReadable() || (events & (EPOLLERR | EPOLLHUP))) {
+            break;
+        }
+    }
+    std::cerr << "main: " << sml.device() << " failed" << std::endl;
+    failed();
+}
 
-/** handle SIGTERM */
-void signalHandler(int /*signum*/)
+/**
+ * publish the metrics periodically
+ *
+ * @param[in] loop event loop
+ * @param[in] interval interval
+ * @param[in] topic topic (e.g. /devices/123456-energy/controls/$stats)
+ * @throw std::system_error if the timer can't be created
+ */
+static Task publishMetrics(EventLoop & loop, std::chrono::seconds interval, std::string topic)
 {
-    abortLoop = true;
+    Ticker ticker(loop, interval);
+    for (;;) {
+        co_await ticker;
+        mqttClient()->setTopic(topic, metrics().json());
+    }
 }
+#endif
+
+/** configuration of one broker */
+struct BrokerConfig
+{
+    /** label of the metrics */
+    std::string name;
+
+    /** host name */
+    std::string host;
+
+    /** port */
+    int port;
+
+    /** QoS of the published messages */
+    int qos;
+
+    /** MQTT protocol version */
+    int version;
+
+    /** QoS 1/2 messages in flight */
+    unsigned int maxInflight;
+
+    /** messages queued by libmosquitto, 0 for no limit */
+    std::size_t maxQueued;
+
+    /** client id */
+    std::string id;
+
+    /** user name */
+    std::string username;
+
+    /** password */
+    std::string password;
+
+    /** values queued for the publisher thread, 0 to publish from the reading thread */
+    std::size_t publishQueue;
+
+    /** handling of a full queue */
+    PublishQueue::Overflow publishOverflow;
+};
 
 /** main function */
 int main(int argc, char ** argv)
@@ -64,17 +180,38 @@ int main(int argc, char ** argv)
     std::string host = "localhost";
     int port = 1883;
     int qos = 1;
+    int version = MQTT_PROTOCOL_V311;
+    unsigned int maxInflight = 20;
+    std::size_t maxQueued = 0;
     bool verbose = false;
     std::string topic = "/devices/123456-energy/controls";
     std::string id = "sml2mqtt";
     std::string username = "";
     std::string password = "";
     std::string device = "/dev/vzir0";
+    ObisMap registers = ObisMap::defaults();
+    bool verifyCrc = true;
+    SnapshotFormat snapshot = SnapshotFormat::None;
+    bool snapshotOnly = false;
+    std::vector<MeterConfig> meterConfigs;
+    std::vector<BrokerConfig> brokerConfigs;
+    std::string replayFile = "";
+    double replaySpeed = 1;
+    std::string captureFile = "";
+    std::string spoolFile = "";
+    std::size_t spoolRecords = 65536;
+    std::size_t spoolRate = 20;
+    std::size_t publishQueue = 1024;
+    PublishQueue::Overflow publishOverflow = PublishQueue::Overflow::Coalesce;
+    int warmUpTimeout = 2000;
+    std::string storeDirectory = "";
+    int metricsInterval = 60;
+    std::string metricsSocket = "";
     YAML::Node config;
 
     /* evaluate command line parameters */
     int c;
-    while ((c = getopt(argc, argv, "c:h:p:q:t:i:u:P:d:v?")) != -1) {
+    while ((c = getopt(argc, argv, "c:h:p:q:t:i:u:P:d:r:s:w:v?")) != -1) {
         switch (c) {
         case 'c':
             config = YAML::LoadFile(optarg);
@@ -90,6 +227,23 @@ int main(int argc, char ** argv)
                 qos = config["qos"].as<int>();
                 if (verbose) std::cout << "Using yaml config qos: " << qos << std::endl;
             }
+            if (config["mqtt_version"]) {
+                try {
+                    version = MqttClient::parseVersion(config["mqtt_version"].as<std::string>());
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (verbose) std::cout << "Using yaml config mqtt_version: " << config["mqtt_version"].as<std::string>() << std::endl;
+            }
+            if (config["max_inflight"]) {
+                maxInflight = config["max_inflight"].as<unsigned int>();
+                if (verbose) std::cout << "Using yaml config max_inflight: " << maxInflight << std::endl;
+            }
+            if (config["max_queued"]) {
+                maxQueued = config["max_queued"].as<std::size_t>();
+                if (verbose) std::cout << "Using yaml config max_queued: " << maxQueued << std::endl;
+            }
             if (config["topic"]) {
                 topic = config["topic"].as<std::string>();
                 if (verbose) std::cout << "Using yaml config topic: " << topic << std::endl;
@@ -110,6 +264,160 @@ int main(int argc, char ** argv)
                 device = config["device"].as<std::string>();
                 if (verbose) std::cout << "Using yaml config device: " << device << std::endl;
             }
+            if (config["crc"]) {
+                verifyCrc = config["crc"].as<bool>();
+                if (verbose) std::cout << "Using yaml config crc: " << verifyCrc << std::endl;
+            }
+            if (config["snapshot"]) {
+                try {
+                    snapshot = SnapshotEncoder::parseFormat(config["snapshot"].as<std::string>());
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (verbose) std::cout << "Using yaml config snapshot: " << config["snapshot"].as<std::string>() << std::endl;
+            }
+            if (config["snapshot_only"]) {
+                snapshotOnly = config["snapshot_only"].as<bool>();
+                if (verbose) std::cout << "Using yaml config snapshot_only: " << snapshotOnly << std::endl;
+            }
+            if (config["spool"]) {
+                spoolFile = config["spool"].as<std::string>();
+                if (verbose) std::cout << "Using yaml config spool: " << spoolFile << std::endl;
+            }
+            if (config["spool_records"]) {
+                spoolRecords = config["spool_records"].as<std::size_t>();
+                if (verbose) std::cout << "Using yaml config spool_records: " << spoolRecords << std::endl;
+            }
+            if (config["warmup_timeout"]) {
+                warmUpTimeout = config["warmup_timeout"].as<int>();
+                if (verbose) std::cout << "Using yaml config warmup_timeout: " << warmUpTimeout << std::endl;
+            }
+            if (config["spool_rate"]) {
+                spoolRate = config["spool_rate"].as<std::size_t>();
+                if (verbose) std::cout << "Using yaml config spool_rate: " << spoolRate << std::endl;
+            }
+            if (config["publish_queue"]) {
+                publishQueue = config["publish_queue"].as<std::size_t>();
+                if (verbose) std::cout << "Using yaml config publish_queue: " << publishQueue << std::endl;
+            }
+            if (config["publish_overflow"]) {
+                try {
+                    publishOverflow = PublishQueue::parseOverflow(config["publish_overflow"].as<std::string>());
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (verbose) std::cout << "Using yaml config publish_overflow: " << config["publish_overflow"].as<std::string>() << std::endl;
+            }
+            if (config["store"]) {
+                storeDirectory = config["store"].as<std::string>();
+                if (verbose) std::cout << "Using yaml config store: " << storeDirectory << std::endl;
+            }
+            if (config["stats_interval"]) {
+                metricsInterval = config["stats_interval"].as<int>();
+                if (verbose) std::cout << "Using yaml config stats_interval: " << metricsInterval << std::endl;
+            }
+            if (config["metrics_socket"]) {
+                metricsSocket = config["metrics_socket"].as<std::string>();
+                if (verbose) std::cout << "Using yaml config metrics_socket: " << metricsSocket << std::endl;
+            }
+            if (config["registers"]) {
+                try {
+                    registers.load(config["registers"]);
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (verbose) {
+                    for (const ObisRegister & reg : registers) {
+                        std::cout << "Using yaml config register: " << obisToString(reg.obis) << " -> " << reg.topic << std::endl;
+                    }
+                }
+            }
+            if (config["brokers"]) {
+                /* each broker needs a host, the other settings default to the global ones */
+                brokerConfigs.clear();
+                try {
+                    if (!config["brokers"].IsSequence()) {
+                        throw std::invalid_argument("brokers: must be a list");
+                    }
+                    for (const YAML::Node & broker : config["brokers"]) {
+                        if (!broker["host"]) {
+                            throw std::invalid_argument("brokers: host is required");
+                        }
+                        BrokerConfig brokerConfig = { "", broker["host"].as<std::string>(), port, qos, version, maxInflight, maxQueued, id, username, password, publishQueue, publishOverflow };
+                        brokerConfig.name = broker["name"] ? broker["name"].as<std::string>() : brokerConfig.host;
+                        if (broker["port"]) {
+                            brokerConfig.port = broker["port"].as<int>();
+                        }
+                        if (broker["qos"]) {
+                            brokerConfig.qos = broker["qos"].as<int>();
+                        }
+                        if (broker["mqtt_version"]) {
+                            brokerConfig.version = MqttClient::parseVersion(broker["mqtt_version"].as<std::string>());
+                        }
+                        if (broker["max_inflight"]) {
+                            brokerConfig.maxInflight = broker["max_inflight"].as<unsigned int>();
+                        }
+                        if (broker["max_queued"]) {
+                            brokerConfig.maxQueued = broker["max_queued"].as<std::size_t>();
+                        }
+                        if (broker["id"]) {
+                            brokerConfig.id = broker["id"].as<std::string>();
+                        }
+                        if (broker["username"]) {
+                            brokerConfig.username = broker["username"].as<std::string>();
+                        }
+                        if (broker["password"]) {
+                            brokerConfig.password = broker["password"].as<std::string>();
+                        }
+                        if (broker["publish_queue"]) {
+                            brokerConfig.publishQueue = broker["publish_queue"].as<std::size_t>();
+                        }
+                        if (broker["publish_overflow"]) {
+                            brokerConfig.publishOverflow = PublishQueue::parseOverflow(broker["publish_overflow"].as<std::string>());
+                        }
+                        brokerConfigs.push_back(brokerConfig);
+                        if (verbose) std::cout << "Using yaml config broker: " << brokerConfig.name << " -> " << brokerConfig.host << ":" << brokerConfig.port << std::endl;
+                    }
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            if (config["meters"]) {
+                /* each meter needs device and topic, registers default to the global ones */
+                meterConfigs.clear();
+                try {
+                    if (!config["meters"].IsSequence()) {
+                        throw std::invalid_argument("meters: must be a list");
+                    }
+                    for (const YAML::Node & meter : config["meters"]) {
+                        if (!meter["device"] || !meter["topic"]) {
+                            throw std::invalid_argument("meters: device and topic are required");
+                        }
+                        MeterConfig meterConfig = { meter["device"].as<std::string>(), meter["topic"].as<std::string>(), registers, verifyCrc, snapshot, snapshotOnly };
+                        if (meter["registers"]) {
+                            meterConfig.registers.load(meter["registers"]);
+                        }
+                        if (meter["crc"]) {
+                            meterConfig.verifyCrc = meter["crc"].as<bool>();
+                        }
+                        if (meter["snapshot"]) {
+                            meterConfig.snapshot = SnapshotEncoder::parseFormat(meter["snapshot"].as<std::string>());
+                        }
+                        if (meter["snapshot_only"]) {
+                            meterConfig.snapshotOnly = meter["snapshot_only"].as<bool>();
+                        }
+                        meterConfigs.push_back(meterConfig);
+                        if (verbose) std::cout << "Using yaml config meter: " << meterConfig.device << " -> " << meterConfig.topic << std::endl;
+                    }
+                } catch (std::exception & e) {
+                    std::cerr << "main: " << e.what() << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
             break;
         case 'h':
             host = optarg;
@@ -143,11 +451,27 @@ int main(int argc, char ** argv)
             device = optarg;
             if (verbose) std::cout << "Using command line config device: " << device << std::endl;
             break;
+        case 'r':
+            replayFile = optarg;
+            if (verbose) std::cout << "Using command line config replay: " << replayFile << std::endl;
+            break;
+        case 's':
+            replaySpeed = atof(optarg);
+            if (replaySpeed < 0) {
+                std::cerr << "main: replay speed must not be negative" << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (verbose) std::cout << "Using command line config replay speed: " << replaySpeed << std::endl;
+            break;
+        case 'w':
+            captureFile = optarg;
+            if (verbose) std::cout << "Using command line config capture: " << captureFile << std::endl;
+            break;
         case 'v':
             verbose = true;
             break;
         default:
-            std::cout << "Usage: sml2mqtt [-v] [-c config.yaml] [-h host] [-p port] [-q qos] [-t topic] [-i id] [-u username] [-P password] [-d device]" << std::endl
+            std::cout << "Usage: sml2mqtt [-v] [-c config.yaml] [-h host] [-p port] [-q qos] [-t topic] [-i id] [-u username] [-P password] [-d device] [-r capture [-s speed]] [-w capture]" << std::endl
                 << "-v: Be verbose, use this first to get all verbose messages" << std::endl
                 << "-c: Use YAML config file <config.yaml> (can be combined with other options)" << std::endl
                 << "-h: hostname of broker" << std::endl
@@ -157,73 +481,303 @@ int main(int argc, char ** argv)
                 << "-i: ID of broker client (e.g. sml2mqtt)" << std::endl
                 << "-u: username" << std::endl
                 << "-p: password" << std::endl
-                << "-d: device to read sml messages from (e.g. /dev/vzir0)" << std::endl;
+                << "-d: device to read sml messages from (e.g. /dev/vzir0)" << std::endl
+                << "-r: replay a capture file (or raw SML stream) instead of reading the device" << std::endl
+                << "-s: replay speed, 1 real time (default), N times faster, 0 as fast as possible" << std::endl
+                << "-w: record everything read from the device to a capture file" << std::endl
+                << "-t and -d are ignored if the config file contains a meters list" << std::endl
+                << "-h, -p, -q, -i, -u and -P are ignored if the config file contains a brokers list" << std::endl
+                << "-r replays to the first meter, -w needs a single meter" << std::endl;
             return EXIT_FAILURE;
         }
     }
 
-    /* register signal handler */
-    abortLoop = false;
-    signal(SIGTERM, signalHandler);
+    /* a single meter, if no meters list is configured */
+    if (meterConfigs.empty()) {
+        meterConfigs.push_back({ device, topic, registers, verifyCrc, snapshot, snapshotOnly });
+    }
+    /* a single broker, if no brokers list is configured */
+    if (brokerConfigs.empty()) {
+        brokerConfigs.push_back({ "", host, port, qos, version, maxInflight, maxQueued, id, username, password, publishQueue, publishOverflow });
+    }
+    for (const BrokerConfig & brokerConfig : brokerConfigs) {
+        if (brokerConfigs.size() > 1 && brokerConfig.publishQueue == 0) {
+            std::cerr << "main: " << brokerConfig.name << ": publish_queue must not be 0 with several brokers" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (!captureFile.empty() && (!replayFile.empty() || meterConfigs.size() != 1)) {
+        std::cerr << "main: -w needs a single meter and can't be combined with -r" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /* event loop, signals must be blocked before any thread is started */
+    std::unique_ptr<EventLoop> loop;
+    try {
+        loop.reset(new EventLoop());
+        loop->addSignal(SIGTERM, [&loop]() {
+            loop->stop();
+        });
+        loop->addSignal(SIGINT, [&loop]() {
+            loop->stop();
+        });
+        loop->addSignal(SIGUSR1, []() {
+            latencyTracer().dump(std::cout);
+        });
+    } catch (std::exception & e) {
+        std::cerr << "main: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     /* mosquitto constructor */
-    if (mosqpp::lib_init() != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_lib_init() != MOSQ_ERR_SUCCESS) {
         std::cerr << "main: lib_init failed" << std::endl;
         return EXIT_FAILURE;
     }
 
-    /* start MqttClient */
-    mqttClient() = new MqttClient(host.c_str(), port, qos, topic.c_str(), id.c_str(), username.c_str(), password.c_str(), verbose);
-
+    /* start MqttClient, the first broker gets the values from the meters and passes them to the others */
+    const BrokerConfig & primary = brokerConfigs.front();
+    std::vector<std::unique_ptr<MqttClient>> mirrors;
+    try {
+        mqttClient() = new MqttClient(primary.host.c_str(), primary.port, primary.qos, primary.id.c_str(), primary.username.c_str(), primary.password.c_str(), verbose, primary.name, primary.version, primary.maxInflight);
+        mqttClient()->setMaxQueued(primary.maxQueued);
+        for (std::size_t i = 1; i < brokerConfigs.size(); i++) {
+            const BrokerConfig & broker = brokerConfigs[i];
+            mirrors.emplace_back(new MqttClient(broker.host.c_str(), broker.port, broker.qos, broker.id.c_str(), broker.username.c_str(), broker.password.c_str(), verbose, broker.name, broker.version, broker.maxInflight));
+            mirrors.back()->setMaxQueued(broker.maxQueued);
+            mirrors.back()->startPublisher(broker.publishQueue, broker.publishOverflow, 0);
+            mqttClient()->addMirror(mirrors.back().get());
+        }
+    } catch (std::exception & e) {
+        std::cerr << "main: " << e.what() << std::endl;
+        delete mqttClient();
+        return EXIT_FAILURE;
+    }
 
     // check if MQTT client is available
     if (!mqttClient()) {
         return EXIT_FAILURE;
     }
 
-    // setup HomA meta data
-    /*
-        {'obis': '1-0:16.7.0*255', 'scale': 1, 'unit': ' W', 'topic': 'Current Power'},
-    	{'obis': '1-0:1.8.0*255', 'scale': 1000, 'unit': ' kWh', 'topic': 'Total Energy'}
-    */
-	mqttClient()->setTopic("Current Power/meta/type", "text");
-	mqttClient()->setTopic("Current Power/meta/unit", " W");
-	mqttClient()->setTopic("Current Power/meta/order", "1");
-	mqttClient()->setTopic("Total Energy/meta/type", "text");
-	mqttClient()->setTopic("Total Energy/meta/unit", " kWh");
-	mqttClient()->setTopic("Total Energy/meta/order", "2");
+    /* offline spool, drained at spoolRate values per second after reconnect */
+    std::unique_ptr<Spool> spool;
+    std::size_t backfillPerTick = 0;
+    std::chrono::milliseconds backfillInterval(100);
+    if (!spoolFile.empty()) {
+        try {
+            if (spoolRate == 0) {
+                throw std::invalid_argument("spool_rate must not be 0");
+            }
+            spool.reset(new Spool(spoolFile, spoolRecords));
+            mqttClient()->setSpool(spool.get());
 
-    /* init all channels */
-    SML sml(device);
-    if (!sml.is_open()) {
-        return -1;
+            /* at most 10 ticks per second, e.g. 5 values/s as 1 value every 200 ms, 25 values/s as 3 every 120 ms */
+            backfillPerTick = (spoolRate + 9) / 10;
+            backfillInterval = std::chrono::milliseconds(1000 * backfillPerTick / spoolRate);
+            if (primary.publishQueue == 0) {
+                loop->addTimer(backfillInterval, [backfillPerTick]() {
+                    mqttClient()->backfill(backfillPerTick);
+                });
+            }
+            metrics().callback("spool_values", "values waiting in the offline spool", Metrics::Type::Gauge, "", spool.get(), [&spool]() { return spool->size(); });
+            metrics().callback("spool_dropped", "values lost by the offline spool", Metrics::Type::Counter, "", spool.get(), [&spool]() { return spool->dropped(); });
+            if (verbose) std::cout << "Spool " << spoolFile << " holds " << spool->size() << " values" << std::endl;
+        } catch (std::exception & e) {
+            std::cerr << "main: " << e.what() << std::endl;
+            delete mqttClient();
+            return EXIT_FAILURE;
+        }
     }
 
-#ifdef WITH_SYSTEMD
-    /* systemd notify */
-    sd_notify(0, "READY=1");
+    /* publish from a thread of its own, a slow broker does not delay reading */
+    if (primary.publishQueue > 0) {
+        try {
+            mqttClient()->startPublisher(primary.publishQueue, primary.publishOverflow, backfillPerTick, backfillInterval);
+        } catch (std::exception & e) {
+            std::cerr << "main: " << e.what() << std::endl;
+            delete mqttClient();
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* seed the change detection from the retained values, to not publish them again after a restart */
+    if (warmUpTimeout > 0) {
+        std::vector<std::string> warmUpTopics;
+        for (const MeterConfig & meterConfig : meterConfigs) {
+            warmUpTopics.push_back(meterConfig.topic + "/#");
+            if (!replayFile.empty()) {
+                break;
+            }
+        }
+        std::size_t retained = mqttClient()->warmUp(warmUpTopics, std::chrono::milliseconds(warmUpTimeout));
+        if (verbose) std::cout << "Warm-up: " << retained << " retained values" << std::endl;
+    }
+
+    /* init all meters, they share the MQTT client and the event loop */
+    std::unique_ptr<CaptureWriter> capture;
+    std::unique_ptr<TimeSeriesStore> store;
+    std::vector<std::unique_ptr<SML>> meters;
+    for (const MeterConfig & meterConfig : meterConfigs) {
+        /* a replay feeds the first meter instead of its device */
+        std::unique_ptr<SML> sml;
+        try {
+            sml.reset(new SML(replayFile.empty() ? meterConfig.device : "", meterConfig.topic, meterConfig.registers, meterConfig.verifyCrc));
+        } catch (std::exception & e) {
+            std::cerr << "main: " << meterConfig.device << ": " << e.what() << std::endl;
+            continue;
+        }
+        if (replayFile.empty() && !sml->is_open()) {
+            continue;
+        }
+        sml->setSnapshot(meterConfig.snapshot, meterConfig.snapshotOnly);
+        sml->publishMeta();
+        meters.push_back(std::move(sml));
+        if (!replayFile.empty()) {
+            break;
+        }
+    }
+    if (meters.empty()) {
+        delete mqttClient();
+        return EXIT_FAILURE;
+    }
+    if (!storeDirectory.empty()) {
+        try {
+            store.reset(new TimeSeriesStore(storeDirectory));
+            for (const std::unique_ptr<SML> & sml : meters) {
+                sml->setStore(store.get());
+            }
+        } catch (std::exception & e) {
+            std::cerr << "main: " << e.what() << std::endl;
+            delete mqttClient();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!captureFile.empty()) {
+        try {
+            capture.reset(new CaptureWriter(captureFile));
+        } catch (std::exception & e) {
+            std::cerr << "main: " << e.what() << std::endl;
+            delete mqttClient();
+            return EXIT_FAILURE;
+        }
+        meters.front()->setCapture(capture.get());
+    }
+
+    /* read meters and publish via MQTT */
+    int exitCode = EXIT_SUCCESS;
+    std::size_t openMeters = meters.size();
+    std::unique_ptr<Replay> replay;
+    std::unique_ptr<MetricsServer> metricsServer;
+#ifdef WITH_COROUTINES
+    std::vector<Task> tasks;
 #endif
+    try {
+        if (!replayFile.empty()) {
+            replay.reset(new Replay(*loop, *meters.front(), replayFile, replaySpeed));
+            replay->start([&loop]() {
+                loop->stop();
+            });
+        }
+        for (const std::unique_ptr<SML> & meter : meters) {
+            if (!meter->is_open()) {
+                continue;
+            }
+#ifdef WITH_COROUTINES
+            /* keep the other meters running, fail if none is left */
+            tasks.push_back(readMeter(*loop, *meter, [&]() {
+                if (--openMeters == 0) {
+                    exitCode = EXIT_FAILURE;
+                    loop->stop();
+                }
+            }));
+#else
+            SML * sml = meter.get();
+            loop->addFd(sml->fd(), EPOLLIN, [&, sml](uint32_t events) {
+                if (!sml->onReadable() || (events & (EPOLLERR | EPOLLHUP))) {
+                    /* keep the other meters running, fail if none is left */
+                    std::cerr << "main: " << sml->device() << " failed" << std::endl;
+                    loop->removeFd(sml->fd());
+                    if (--openMeters == 0) {
+                        exitCode = EXIT_FAILURE;
+                        loop->stop();
+                    }
+                }
+            });
+#endif
+        }
 
-    /* start publish loop */
-    while (!abortLoop) {
 #ifdef WITH_SYSTEMD
-        /* systemd notify */
-        sd_notify(0, "WATCHDOG=1");
+        /* systemd watchdog, notify twice per watchdog interval */
+        uint64_t watchdogUsec = 0;
+        if (sd_watchdog_enabled(0, &watchdogUsec) > 0) {
+            loop->addTimer(std::chrono::milliseconds(watchdogUsec / 2000), []() {
+                sd_notify(0, "WATCHDOG=1");
+            });
+        }
 #endif
 
-        /* read channels and publish via MQTT */
-        // listen on the serial device, this call is blocking.
-        sml.transport_listen();
+        /* metrics as retained JSON on <topic of first meter>/$stats, and on a Unix socket */
+        if (metricsInterval > 0) {
+            std::string metricsTopic = meterConfigs.front().topic + "/$stats";
+#ifdef WITH_COROUTINES
+            tasks.push_back(publishMetrics(*loop, std::chrono::seconds(metricsInterval), metricsTopic));
+#else
+            loop->addTimer(std::chrono::seconds(metricsInterval), [metricsTopic]() {
+                mqttClient()->setTopic(metricsTopic, metrics().json());
+            });
+#endif
+        }
+        if (!metricsSocket.empty()) {
+            metricsServer.reset(new MetricsServer(*loop, metrics(), metricsSocket));
+        }
+
+        /* statistics */
+        if (verbose) {
+            loop->addTimer(statsInterval, [&meters, &spool]() {
+                for (const std::unique_ptr<SML> & sml : meters) {
+                    std::cout << sml->device() << ": "
+                        << sml->bytesRead() << " bytes, "
+                        << sml->framesReceived() << " frames, "
+                        << sml->framesDropped() << " dropped, "
+                        << sml->crcErrors() << " CRC errors, "
+                        << sml->parseErrors() << " parse errors" << std::endl;
+                }
+                if (spool) {
+                    std::cout << "spool: " << spool->size() << " values, " << spool->dropped() << " dropped" << std::endl;
+                }
+                latencyTracer().dump(std::cout);
+            });
+        }
+    } catch (std::exception & e) {
+        std::cerr << "main: " << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
+#ifdef WITH_SYSTEMD
+    /* systemd notify */
+    sd_notify(0, "READY=1");
+#endif
+
+    /* dispatch until SIGTERM, device failure or end of replay */
+    loop->run();
+
     /* delete resources */
+    if (replay) {
+        replay->printStats(std::cout);
+        replay.reset();
+    }
+#ifdef WITH_COROUTINES
+    tasks.clear();
+#endif
+    meters.clear();
     delete mqttClient();
+    mirrors.clear();
 
     /* mosquitto destructor */
-    if (mosqpp::lib_cleanup() != MOSQ_ERR_SUCCESS) {
+    if (mosquitto_lib_cleanup() != MOSQ_ERR_SUCCESS) {
         std::cerr << "main: lib_cleanup failed" << std::endl;
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return exitCode;
 }
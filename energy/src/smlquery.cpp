@@ -0,0 +1,301 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+
+/* C includes */
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+/* project internal includes */
+#include "TimeSeries.h"
+
+/**
+ * names of the entries of a directory that are directories
+ *
+ * @param[in] directory directory
+ * @return sorted names
+ */
+static std::vector<std::string> subdirectories(const std::string & directory)
+{
+    std::vector<std::string> names;
+    DIR * dir = opendir(directory.c_str());
+    if (!dir) {
+        return names;
+    }
+    while (struct dirent * entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        struct stat st;
+        if (name[0] != '.' && stat((directory + "/" + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/**
+ * all channels of a store
+ *
+ * @param[in] directory store directory
+ * @return channel names (e.g. vzir0/1-0_1.8.0_255)
+ */
+static std::vector<std::string> channels(const std::string & directory)
+{
+    std::vector<std::string> channels;
+    for (const std::string & meter : subdirectories(directory)) {
+        for (const std::string & reg : subdirectories(directory + "/" + meter)) {
+            channels.push_back(meter + "/" + reg);
+        }
+    }
+    return channels;
+}
+
+/**
+ * channel name from the command line
+ *
+ * @param[in] arg channel name or <meter>/<OBIS code> (e.g. vzir0/1-0:1.8.0*255)
+ * @return channel name
+ */
+static std::string channelArg(const std::string & arg)
+{
+    std::size_t slash = arg.rfind('/');
+    if (slash == std::string::npos) {
+        return TimeSeriesStore::channelName("feed", arg);
+    }
+    return TimeSeriesStore::channelName(arg.substr(0, slash), arg.substr(slash + 1));
+}
+
+/**
+ * time from the command line
+ *
+ * @param[in] arg seconds since the epoch or local time as YYYY-MM-DD[THH:MM[:SS]]
+ * @param[out] time ms since the epoch
+ * @return false if arg is invalid
+ */
+static bool timeArg(const std::string & arg, int64_t & time)
+{
+    char * end;
+    long long seconds = strtoll(arg.c_str(), &end, 10);
+    if (!arg.empty() && *end == '\0') {
+        time = seconds * 1000;
+        return true;
+    }
+
+    struct tm tm = {};
+    tm.tm_isdst = -1;
+    int n = sscanf(arg.c_str(), "%d-%d-%d%*1[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n != 3 && n != 5 && n != 6) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_t t = mktime(&tm);
+    if (t == -1) {
+        return false;
+    }
+    time = static_cast<int64_t>(t) * 1000;
+    return true;
+}
+
+/**
+ * format a time as local time
+ *
+ * @param[in] time ms since the epoch
+ * @return YYYY-MM-DDTHH:MM:SS.mmm
+ */
+static std::string formatTime(int64_t time)
+{
+    time_t t = static_cast<time_t>(time / 1000);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    char ms[8];
+    snprintf(ms, sizeof(ms), ".%03d", static_cast<int>(time % 1000));
+    return std::string(buf) + ms;
+}
+
+/**
+ * print the size of a channel
+ *
+ * @param[in] directory store directory
+ * @param[in] channel channel name
+ * @param[in] from first time in ms since the epoch
+ * @param[in] to last time in ms since the epoch
+ */
+static void printInfo(const std::string & directory, const std::string & channel, int64_t from, int64_t to)
+{
+    /* only the block headers are read */
+    TimeSeriesReader reader(directory + "/" + channel);
+    uint64_t blocks = 0;
+    uint64_t samples = 0;
+    int64_t first = 0;
+    int64_t last = 0;
+    reader.scan(from, to, nullptr, [&](const TimeSeriesBlockHeader & header) {
+        if (header.count > 0) {
+            if (samples == 0) {
+                first = header.firstTime;
+            }
+            last = header.lastTime;
+        }
+        blocks++;
+        samples += header.count;
+        return false;
+    });
+
+    std::cout << channel << ": " << samples << " samples in " << blocks << " blocks";
+    if (samples > 0) {
+        char ratio[16];
+        snprintf(ratio, sizeof(ratio), "%.2f", static_cast<double>(blocks * timeSeriesBlockSize) / samples);
+        std::cout << ", " << ratio << " bytes/sample, " << formatTime(first) << " to " << formatTime(last);
+    }
+    std::cout << std::endl;
+}
+
+/** main function */
+int main(int argc, char ** argv)
+{
+    /* default parameters */
+    std::string directory = "";
+    std::string channel = "";
+    int64_t from = 0;
+    int64_t to = std::numeric_limits<int64_t>::max();
+    int64_t step = 0;
+    bool list = false;
+    bool info = false;
+
+    /* evaluate command line parameters */
+    int c;
+    while ((c = getopt(argc, argv, "d:c:f:t:s:li?")) != -1) {
+        switch (c) {
+        case 'd':
+            directory = optarg;
+            break;
+        case 'c':
+            channel = channelArg(optarg);
+            break;
+        case 'f':
+            if (!timeArg(optarg, from)) {
+                std::cerr << "main: invalid time " << optarg << std::endl;
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            if (!timeArg(optarg, to)) {
+                std::cerr << "main: invalid time " << optarg << std::endl;
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            step = atol(optarg) * 1000;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'i':
+            info = true;
+            break;
+        default:
+            std::cout << "Usage: smlquery -d store [-l] [-i] [-c channel] [-f from] [-t to] [-s step]" << std::endl
+                << "-d: store directory of sml2mqtt (config key store)" << std::endl
+                << "-l: list the channels" << std::endl
+                << "-i: print samples and bytes per sample of the channel (all channels without -c)" << std::endl
+                << "-c: channel as <meter>/<OBIS code> (e.g. vzir0/1-0:1.8.0*255)" << std::endl
+                << "-f: first time, seconds since the epoch or local YYYY-MM-DD[THH:MM[:SS]]" << std::endl
+                << "-t: last time, like -f" << std::endl
+                << "-s: print time,min,max,mean,count per step seconds instead of every sample" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (directory.empty()) {
+        std::cerr << "main: no store directory given (-d)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (list) {
+        for (const std::string & name : channels(directory)) {
+            std::cout << name << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (info) {
+        std::vector<std::string> names = channel.empty() ? channels(directory) : std::vector<std::string>{ channel };
+        for (const std::string & name : names) {
+            printInfo(directory, name, from, to);
+        }
+        return EXIT_SUCCESS;
+    }
+    if (channel.empty()) {
+        std::cerr << "main: no channel given (-c)" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    TimeSeriesReader reader(directory + "/" + channel);
+    std::cout.precision(std::numeric_limits<double>::digits10);
+    bool ok;
+    if (step <= 0) {
+        std::cout << "time,value" << std::endl;
+        ok = reader.scan(from, to, [&](const TimeSeriesSample & sample) {
+            std::cout << formatTime(sample.time) << "," << sample.value << '\n';
+            return true;
+        });
+    } else {
+        /* buckets aligned to multiples of step since the epoch */
+        int64_t bucket = std::numeric_limits<int64_t>::min();
+        double min = 0, max = 0, sum = 0;
+        uint64_t count = 0;
+        auto flush = [&]() {
+            if (count > 0) {
+                std::cout << formatTime(bucket) << "," << min << "," << max << "," << sum / count << "," << count << '\n';
+            }
+        };
+        std::cout << "time,min,max,mean,count" << std::endl;
+        ok = reader.scan(from, to, [&](const TimeSeriesSample & sample) {
+            int64_t start = sample.time - sample.time % step;
+            if (start != bucket) {
+                flush();
+                bucket = start;
+                min = max = sum = sample.value;
+                count = 1;
+            } else {
+                min = std::min(min, sample.value);
+                max = std::max(max, sample.value);
+                sum += sample.value;
+                count++;
+            }
+            return true;
+        });
+        flush();
+    }
+    if (!ok) {
+        std::cerr << "main: can't read channel " << channel << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
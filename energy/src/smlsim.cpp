@@ -0,0 +1,379 @@
+/*
+ * Holger Mueller
+ *
+ * This file is part of sml2mqtt.
+ *
+ * GNU General Public License 3.0 Usage
+ * This file may be used under the terms of the GNU
+ * General Public License version 3.0 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.  Please review the following information to
+ * ensure the GNU General Public License version 3.0 requirements will be
+ * met: http://www.gnu.org/copyleft/gpl.html.
+ */
+
+
+/* C includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* C++ includes */
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+/* project internal includes */
+#include "EventLoop.h"
+#include "Obis.h"
+#include "SmlEncoder.h"
+
+/** interval the line is served in */
+static const std::chrono::milliseconds lineTick(10);
+
+/** server id of the simulated meter */
+static const std::string serverId("\x0a\x01" "SIM\x00\x00\x00\x00\x01", 10);
+
+/** simulated register */
+struct SimRegister
+{
+    /** entry, value is the start value */
+    SmlEncoder::Entry entry;
+
+    /** added to the value per telegram */
+    int64_t step;
+
+    /** random deviation per telegram, not accumulated */
+    int64_t jitter;
+};
+
+/**
+ * registers simulated by default
+ *
+ * @return Total Energy (1-0:1.8.0*255) and Current Power (1-0:16.7.0*255)
+ */
+static std::vector<SimRegister> defaultRegisters()
+{
+    std::vector<SimRegister> registers;
+    registers.push_back({ { OBIS_TOTAL_ENERGY, 30, -1, false, 123456789 }, 3, 0 });
+    registers.push_back({ { OBIS_CURRENT_POWER, 27, 0, true, 350 }, 0, 100 });
+    return registers;
+}
+
+/**
+ * load registers from a YAML sequence
+ *
+ * @param[in] node YAML sequence of maps with keys obis, unit, scaler, value, step, jitter, signed
+ * @return registers
+ * @throw std::invalid_argument on invalid entries
+ */
+static std::vector<SimRegister> loadRegisters(const YAML::Node & node)
+{
+    if (!node.IsSequence()) {
+        throw std::invalid_argument("registers: must be a list");
+    }
+    std::vector<SimRegister> registers;
+    for (const YAML::Node & item : node) {
+        SimRegister reg = { { 0, 0, 0, false, 0 }, 0, 0 };
+        if (!item["obis"] || !parseObis(item["obis"].as<std::string>(), reg.entry.obis)) {
+            throw std::invalid_argument("registers: missing or invalid obis");
+        }
+        reg.entry.unit = item["unit"] ? item["unit"].as<int>() : 0;
+        reg.entry.scaler = item["scaler"] ? item["scaler"].as<int>() : 0;
+        reg.entry.isSigned = item["signed"] ? item["signed"].as<bool>() : false;
+        reg.entry.value = item["value"] ? item["value"].as<int64_t>() : 0;
+        reg.step = item["step"] ? item["step"].as<int64_t>() : 0;
+        reg.jitter = item["jitter"] ? item["jitter"].as<int64_t>() : 0;
+        registers.push_back(reg);
+    }
+    return registers;
+}
+
+/**
+ * open a pseudo terminal in raw mode
+ *
+ * The slave is kept open, so the master does not see a hangup while no
+ * reader is attached, and its settings survive until a reader changes them.
+ *
+ * @param[out] slaveName path of the slave (e.g. /dev/pts/3)
+ * @param[out] slaveFd slave file descriptor
+ * @return master file descriptor
+ * @throw std::system_error on failure
+ */
+static int openPty(std::string & slaveName, int & slaveFd)
+{
+    int masterFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (masterFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "posix_openpt");
+    }
+    if (grantpt(masterFd) < 0 || unlockpt(masterFd) < 0 || !ptsname(masterFd)) {
+        int error = errno;
+        close(masterFd);
+        throw std::system_error(error, std::generic_category(), "unlockpt");
+    }
+    slaveName = ptsname(masterFd);
+
+    slaveFd = open(slaveName.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slaveFd < 0) {
+        int error = errno;
+        close(masterFd);
+        throw std::system_error(error, std::generic_category(), "open(" + slaveName + ")");
+    }
+
+    /* no echo or line editing, like a serial line to a meter */
+    struct termios config;
+    tcgetattr(slaveFd, &config);
+    cfmakeraw(&config);
+    cfsetispeed(&config, B9600);
+    cfsetospeed(&config, B9600);
+    tcsetattr(slaveFd, TCSANOW, &config);
+
+    return masterFd;
+}
+
+/** main function */
+int main(int argc, char ** argv)
+{
+    /* default parameters */
+    bool verbose = false;
+    int baud = 9600;
+    int interval = 1000;
+    long count = 0;
+    double corruption = 0;
+    std::string link = "";
+    std::vector<SimRegister> registers = defaultRegisters();
+    YAML::Node config;
+
+    /* evaluate command line parameters */
+    int c;
+    while ((c = getopt(argc, argv, "c:b:i:n:e:l:v?")) != -1) {
+        switch (c) {
+        case 'c':
+            try {
+                config = YAML::LoadFile(optarg);
+                if (config["baud"]) {
+                    baud = config["baud"].as<int>();
+                }
+                if (config["interval"]) {
+                    interval = config["interval"].as<int>();
+                }
+                if (config["corruption"]) {
+                    corruption = config["corruption"].as<double>();
+                }
+                if (config["link"]) {
+                    link = config["link"].as<std::string>();
+                }
+                if (config["registers"]) {
+                    registers = loadRegisters(config["registers"]);
+                }
+            } catch (std::exception & e) {
+                std::cerr << "main: " << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            baud = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 'e':
+            corruption = atof(optarg);
+            break;
+        case 'l':
+            link = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            std::cout << "Usage: smlsim [-v] [-c config.yaml] [-b baud] [-i interval] [-n count] [-e probability] [-l link]" << std::endl
+                << "-v: Be verbose, print every telegram" << std::endl
+                << "-c: Use YAML config file <config.yaml> for baud, interval, corruption, link and registers" << std::endl
+                << "-b: baud rate to emulate, 8-N-1 (" << baud << ")" << std::endl
+                << "-i: telegram interval in ms (" << interval << ")" << std::endl
+                << "-n: stop after count telegrams (0: run until SIGTERM)" << std::endl
+                << "-e: probability of a corrupted telegram (0..1)" << std::endl
+                << "-l: create a symlink to the pty slave (e.g. /tmp/vzir-sim)" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (baud <= 0 || interval <= 0 || corruption < 0 || corruption > 1) {
+        std::cerr << "main: invalid baud rate, interval or corruption probability" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<EventLoop> loop;
+    int masterFd = -1;
+    int slaveFd = -1;
+    std::string slaveName;
+    try {
+        loop.reset(new EventLoop());
+        loop->addSignal(SIGTERM, [&loop]() {
+            loop->stop();
+        });
+        loop->addSignal(SIGINT, [&loop]() {
+            loop->stop();
+        });
+        masterFd = openPty(slaveName, slaveFd);
+    } catch (std::exception & e) {
+        std::cerr << "main: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!link.empty()) {
+        unlink(link.c_str());
+        if (symlink(slaveName.c_str(), link.c_str()) < 0) {
+            std::cerr << "main: symlink(" << link << "): " << strerror(errno) << std::endl;
+            link.clear();
+        }
+    }
+    std::cout << "smlsim: " << (link.empty() ? slaveName : link + " -> " + slaveName) << std::endl;
+
+    /* statistics */
+    long telegrams = 0;
+    long corrupted = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesLost = 0;
+
+    /* bytes not yet sent on the line */
+    std::vector<unsigned char> pending;
+    size_t pendingPos = 0;
+    double credit = 0;
+
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<double> chance(0, 1);
+    SmlEncoder encoder;
+    std::vector<SmlEncoder::Entry> entries;
+    std::vector<unsigned char> frame;
+    uint32_t secIndex = 0;
+
+    auto sendTelegram = [&]() {
+        if (count > 0 && telegrams >= count) {
+            return;
+        }
+
+        entries.clear();
+        for (SimRegister & reg : registers) {
+            SmlEncoder::Entry entry = reg.entry;
+            if (reg.jitter > 0) {
+                entry.value += std::uniform_int_distribution<int64_t>(-reg.jitter, reg.jitter)(rng);
+            }
+            if (!entry.isSigned && entry.value < 0) {
+                entry.value = 0;
+            }
+            entries.push_back(entry);
+            reg.entry.value += reg.step;
+        }
+        encoder.clear();
+        encoder.openResponse(serverId, std::to_string(secIndex));
+        encoder.getListResponse(serverId, secIndex, entries);
+        encoder.closeResponse();
+        encoder.frame(frame);
+        secIndex += (interval + 999) / 1000;
+        telegrams++;
+
+        /* corruption as seen on IR heads: bit errors, lost bytes, truncation, noise */
+        const char * kind = nullptr;
+        if (corruption > 0 && chance(rng) < corruption) {
+            size_t pos = std::uniform_int_distribution<size_t>(8, frame.size() - 1)(rng);
+            switch (std::uniform_int_distribution<int>(0, 3)(rng)) {
+            case 0:
+                frame[pos] ^= 1 << std::uniform_int_distribution<int>(0, 7)(rng);
+                kind = "bit error";
+                break;
+            case 1:
+                frame.erase(frame.begin() + pos);
+                kind = "lost byte";
+                break;
+            case 2:
+                frame.resize(pos);
+                kind = "truncated";
+                break;
+            default:
+                for (int i = std::uniform_int_distribution<int>(1, 16)(rng); i > 0; i--) {
+                    frame.insert(frame.begin(), static_cast<unsigned char>(rng()));
+                }
+                kind = "noise";
+                break;
+            }
+            corrupted++;
+        }
+        if (verbose) {
+            std::cout << "smlsim: telegram " << telegrams << ", " << frame.size() << " bytes"
+                << (kind ? std::string(", ") + kind : std::string()) << std::endl;
+        }
+
+        if (pendingPos == pending.size()) {
+            pending.clear();
+            pendingPos = 0;
+        }
+        pending.insert(pending.end(), frame.begin(), frame.end());
+    };
+
+    try {
+        /* first telegram right away, then every interval */
+        sendTelegram();
+        loop->addTimer(std::chrono::milliseconds(interval), sendTelegram);
+
+        /* serve the line at the baud rate, 10 bits per byte */
+        loop->addTimer(lineTick, [&]() {
+            size_t available = pending.size() - pendingPos;
+            credit += baud / 10.0 * std::chrono::duration<double>(lineTick).count();
+            size_t len = std::min(available, static_cast<size_t>(credit));
+            if (available == 0) {
+                credit = std::min(credit, 1.0);
+                if (count > 0 && telegrams >= count) {
+                    loop->stop();
+                }
+                return;
+            }
+            if (len == 0) {
+                return;
+            }
+            credit -= len;
+
+            /* a meter keeps sending, bytes nobody reads are lost */
+            ssize_t written = write(masterFd, &pending[pendingPos], len);
+            if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "main: write: " << strerror(errno) << std::endl;
+                loop->stop();
+                return;
+            }
+            if (written < 0) {
+                written = 0;
+            }
+            bytesSent += written;
+            bytesLost += len - written;
+            pendingPos += len;
+        });
+    } catch (std::exception & e) {
+        std::cerr << "main: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    loop->run();
+
+    std::cout << "smlsim: " << telegrams << " telegrams, " << corrupted << " corrupted, "
+        << bytesSent << " bytes sent, " << bytesLost << " bytes lost" << std::endl;
+
+    if (!link.empty()) {
+        unlink(link.c_str());
+    }
+    close(slaveFd);
+    close(masterFd);
+    return EXIT_SUCCESS;
+}